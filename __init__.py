@@ -8,14 +8,27 @@ device with a display and web_server component. Supports three page modes:
   - Native pages: pages: [page_main, page_graph, ...] -- uses ESPHome DisplayPage
   - Global pages: page_global: current_page -- uses a globals<int> for page tracking
 
+Optionally, sweep: declares globals and value sets that GET /screenshot/sweep
+renders in every combination, returned as one multipart/mixed response.
+
+Screenshots can also be streamed over the serial console, triggered by the
+display_capture.serial_capture action or (with serial_console: true) the
+console command "screenshot [page]"; tools/serial_receive.cpp receives them.
+
+On host (Linux) builds, backend: sdl reads the SDL display, and
+shared_memory: publishes the live framebuffer into a POSIX shared-memory
+segment for local tools (see shm_protocol.h).
+
 See README.md for full documentation.
 """
 
+from esphome import automation
 import esphome.codegen as cg
 from esphome.components import web_server_base, display
 from esphome.components.web_server_base import CONF_WEB_SERVER_BASE_ID
 import esphome.config_validation as cv
-from esphome.const import CONF_ID, CONF_DISPLAY_ID
+from esphome.const import CONF_ID, CONF_DISPLAY_ID, PLATFORM_HOST
+from esphome.core import CORE
 
 # web_server_base provides the HTTP server infrastructure (AsyncWebHandler)
 AUTO_LOAD = ["web_server_base"]
@@ -26,15 +39,64 @@ CONF_PAGE_GLOBAL = "page_global"
 CONF_SLEEP_GLOBAL = "sleep_global"
 CONF_PAGE_NAMES = "page_names"
 CONF_BACKEND = "backend"
+CONF_READ_MODE = "read_mode"
+CONF_BURST_ROWS = "burst_rows"
+CONF_BURST_GAP = "burst_gap"
+CONF_TILE_SIZE = "tile_size"
+CONF_SERVE_STALE = "serve_stale"
+CONF_MAX_WAIT = "max_wait"
+CONF_CACHE_SIZE = "cache_size"
+CONF_AUTO_POLICY = "auto_policy"
+CONF_LINK_SPEED = "link_speed"
+CONF_SERIAL_CONSOLE = "serial_console"
+CONF_SHARED_MEMORY = "shared_memory"
+CONF_PAGE = "page"
+CONF_SWEEP = "sweep"
+CONF_GLOBAL = "global"
+CONF_VALUES = "values"
 
 BACKEND_DISPLAY_BUFFER = "display_buffer"
 BACKEND_RPI_DPI_RGB = "rpi_dpi_rgb"
+BACKEND_SDL = "sdl"
+BACKEND_MOCK = "mock"
+
+READ_MODE_DIRECT = "direct"
+READ_MODE_THROTTLED = "throttled"
+
+AUTO_POLICIES = ["balanced", "smallest", "fastest"]
+
+# Upper bound on sweep combinations. Every state is held in one PSRAM buffer
+# (~225 KB each at 320x240, ~1.1 MB at 800x480), so the real limit is free
+# PSRAM: the device checks it before rendering and answers 500 with the
+# number of states that would fit.
+MAX_SWEEP_STATES = 64
 
 # C++ class references for code generation
 display_capture_ns = cg.esphome_ns.namespace("display_capture")
 DisplayCaptureHandler = display_capture_ns.class_(
     "DisplayCaptureHandler", cg.Component
 )
+SerialCaptureAction = display_capture_ns.class_(
+    "SerialCaptureAction", automation.Action
+)
+
+# Framebuffer backends, one class per `backend:` option. A new frame-buffered
+# driver only needs a FramebufferBackend subclass and an entry here.
+FramebufferBackend = display_capture_ns.class_("FramebufferBackend")
+BACKENDS = {
+    BACKEND_DISPLAY_BUFFER: display_capture_ns.class_(
+        "DisplayBufferBackend", FramebufferBackend
+    ),
+    BACKEND_RPI_DPI_RGB: display_capture_ns.class_(
+        "RpiDpiRgbBackend", FramebufferBackend
+    ),
+    # The sdl display of host (Linux) builds
+    BACKEND_SDL: display_capture_ns.class_("SdlBackend", FramebufferBackend),
+    # Test pattern instead of a real framebuffer (bring-up, tests)
+    BACKEND_MOCK: display_capture_ns.class_(
+        "MockFramebufferBackend", FramebufferBackend
+    ),
+}
 
 # References to types from other components.
 # DisplayPage: ESPHome's native page abstraction (defined in display/__init__.py)
@@ -45,29 +107,143 @@ DisplayPage = display_ns.class_("DisplayPage")
 globals_ns = cg.esphome_ns.namespace("globals")
 GlobalsComponent = globals_ns.class_("GlobalsComponent", cg.Component)
 
-CONFIG_SCHEMA = cv.Schema(
+
+def sweep_value(value):
+    """Sweep values are ints; YAML booleans (for globals<bool>) become 0/1."""
+    if isinstance(value, bool):
+        return int(value)
+    return cv.int_(value)
+
+
+SWEEP_AXIS_SCHEMA = cv.Schema(
     {
-        cv.GenerateID(): cv.declare_id(DisplayCaptureHandler),
-        cv.GenerateID(CONF_WEB_SERVER_BASE_ID): cv.use_id(
-            web_server_base.WebServerBase
-        ),
-        # Accepts any Display subclass (ILI9XXX, ST7789V, etc.)
-        cv.Required(CONF_DISPLAY_ID): cv.use_id(display.Display),
-        # cv.Exclusive: pages and page_global are mutually exclusive.
-        # ESPHome config validation rejects YAML that specifies both.
-        cv.Exclusive(CONF_PAGES, "page_mode"): cv.ensure_list(
-            cv.use_id(DisplayPage)
+        # globals<int> or globals<bool> -- the C++ overload is picked by type
+        cv.Required(CONF_GLOBAL): cv.use_id(GlobalsComponent),
+        cv.Required(CONF_VALUES): cv.All(
+            cv.ensure_list(sweep_value), cv.Length(min=1)
         ),
-        cv.Exclusive(CONF_PAGE_GLOBAL, "page_mode"): cv.use_id(GlobalsComponent),
-        # sleep_global: temporarily wakes the display before capture
-        cv.Optional(CONF_SLEEP_GLOBAL): cv.use_id(GlobalsComponent),
-        # page_names: human-readable names returned by /screenshot/info
-        cv.Optional(CONF_PAGE_NAMES): cv.ensure_list(cv.string),
-        cv.Optional(CONF_BACKEND, default=BACKEND_DISPLAY_BUFFER): cv.one_of(
-            BACKEND_DISPLAY_BUFFER, BACKEND_RPI_DPI_RGB, lower=True
-        ),
-    },
-).extend(cv.COMPONENT_SCHEMA)
+    }
+)
+
+
+def validate_byte_size(value):
+    """A size in bytes: an int, or a string with a KB or MB suffix ("512KB")."""
+    if isinstance(value, str):
+        text = value.strip().upper()
+        for suffix, factor in (("MB", 1024 * 1024), ("KB", 1024), ("B", 1)):
+            if text.endswith(suffix):
+                value = cv.int_(text[: -len(suffix)].strip()) * factor
+                break
+    return cv.int_range(min=0)(value)
+
+
+def validate_shm_name(value):
+    """A POSIX shared-memory name: one leading slash, no others ("/display_capture")."""
+    value = cv.string_strict(value)
+    if not value.startswith("/"):
+        value = "/" + value
+    if len(value) < 2 or "/" in value[1:] or len(value) > 255:
+        raise cv.Invalid(
+            f"'{value}' is not a shared-memory name (use e.g. /display_capture)"
+        )
+    return value
+
+
+def validate_backend(config):
+    """Defaults to the host or ESP32 display backend; rejects the other kind."""
+    host_backends = (BACKEND_SDL, BACKEND_MOCK)
+    if CONF_BACKEND not in config:
+        config[CONF_BACKEND] = BACKEND_SDL if CORE.is_host else BACKEND_DISPLAY_BUFFER
+    backend = config[CONF_BACKEND]
+    if CORE.is_host and backend not in host_backends:
+        raise cv.Invalid(
+            f"backend: {backend} reads ESP32 driver memory; use sdl on host builds",
+            path=[CONF_BACKEND],
+        )
+    if not CORE.is_host and backend == BACKEND_SDL:
+        raise cv.Invalid("backend: sdl is for host builds", path=[CONF_BACKEND])
+    return config
+
+
+def validate_sweep(config):
+    states = 1
+    for axis in config.get(CONF_SWEEP, []):
+        states *= len(axis[CONF_VALUES])
+    if states > MAX_SWEEP_STATES:
+        raise cv.Invalid(
+            f"sweep has {states} combinations, maximum is {MAX_SWEEP_STATES}"
+        )
+    return config
+
+
+CONFIG_SCHEMA = cv.All(
+    cv.Schema(
+        {
+            cv.GenerateID(): cv.declare_id(DisplayCaptureHandler),
+            cv.GenerateID(CONF_WEB_SERVER_BASE_ID): cv.use_id(
+                web_server_base.WebServerBase
+            ),
+            # Accepts any Display subclass (ILI9XXX, ST7789V, etc.)
+            cv.Required(CONF_DISPLAY_ID): cv.use_id(display.Display),
+            # cv.Exclusive: pages and page_global are mutually exclusive.
+            # ESPHome config validation rejects YAML that specifies both.
+            cv.Exclusive(CONF_PAGES, "page_mode"): cv.ensure_list(
+                cv.use_id(DisplayPage)
+            ),
+            cv.Exclusive(CONF_PAGE_GLOBAL, "page_mode"): cv.use_id(GlobalsComponent),
+            # sleep_global: temporarily wakes the display before capture
+            cv.Optional(CONF_SLEEP_GLOBAL): cv.use_id(GlobalsComponent),
+            # page_names: human-readable names returned by /screenshot/info
+            cv.Optional(CONF_PAGE_NAMES): cv.ensure_list(cv.string),
+            # backend: defaults to display_buffer, or sdl on host builds
+            cv.Optional(CONF_BACKEND): cv.one_of(*BACKENDS, lower=True),
+            # read_mode: throttled paces framebuffer reads so a live RGB panel's
+            # scanout DMA keeps enough PSRAM bandwidth
+            cv.Optional(CONF_READ_MODE, default=READ_MODE_DIRECT): cv.one_of(
+                READ_MODE_DIRECT, READ_MODE_THROTTLED, lower=True
+            ),
+            # burst_rows / burst_gap: throttled read pacing. The gaps block
+            # loop(), about (rows / burst_rows - 1) * burst_gap per capture.
+            cv.Optional(CONF_BURST_ROWS, default=8): cv.int_range(min=1, max=256),
+            cv.Optional(
+                CONF_BURST_GAP, default="2ms"
+            ): cv.positive_time_period_microseconds,
+            # tile_size: edge length of /screenshot/tile/{z}/{x}/{y} tiles
+            cv.Optional(CONF_TILE_SIZE, default=64): cv.one_of(
+                16, 32, 64, 128, 256, int=True
+            ),
+            # serve_stale / max_wait: answer /screenshot with the last matching
+            # frame (plus an Age header) when a fresh capture would take longer.
+            # Off by default: existing pollers keep getting the current screen.
+            cv.Optional(CONF_SERVE_STALE, default=False): cv.boolean,
+            cv.Optional(
+                CONF_MAX_WAIT, default="1s"
+            ): cv.positive_time_period_milliseconds,
+            # cache_size: PSRAM budget for encoded responses reused while the
+            # screen is unchanged (0 = off). When a hit is likely the capture
+            # hashes in a pass of its own, so a miss then reads the
+            # framebuffer twice.
+            cv.Optional(CONF_CACHE_SIZE, default=0): validate_byte_size,
+            # auto_policy / link_speed: how ?format=auto trades encode time
+            # against size; link_speed is the expected client KB/s
+            cv.Optional(CONF_AUTO_POLICY, default="balanced"): cv.one_of(
+                *AUTO_POLICIES, lower=True
+            ),
+            cv.Optional(CONF_LINK_SPEED, default=250): cv.int_range(min=1),
+            # serial_console: accept "screenshot [page]" on the console UART/USB
+            cv.Optional(CONF_SERIAL_CONSOLE, default=False): cv.boolean,
+            # shared_memory: host builds only -- publish the live framebuffer
+            # into this POSIX shared-memory segment
+            cv.Optional(CONF_SHARED_MEMORY): cv.All(
+                cv.only_on(PLATFORM_HOST), validate_shm_name
+            ),
+            # sweep: globals and value sets rendered by GET /screenshot/sweep
+            cv.Optional(CONF_SWEEP): cv.ensure_list(SWEEP_AXIS_SCHEMA),
+        },
+    ).extend(cv.COMPONENT_SCHEMA),
+    validate_backend,
+    validate_sweep,
+)
 
 
 async def to_code(config):
@@ -78,7 +254,23 @@ async def to_code(config):
 
     disp = await cg.get_variable(config[CONF_DISPLAY_ID])
     cg.add(var.set_display(disp))
-    cg.add(var.set_backend(config[CONF_BACKEND]))
+    backend = BACKENDS[config[CONF_BACKEND]]
+    cg.add(var.set_backend(backend.new(disp)))
+    # Like globals below: the sdl headers only exist in builds that use sdl.
+    if config[CONF_BACKEND] == BACKEND_SDL:
+        cg.add_define("DISPLAY_CAPTURE_USE_SDL")
+    cg.add(var.set_read_mode(config[CONF_READ_MODE]))
+    cg.add(var.set_burst_rows(config[CONF_BURST_ROWS]))
+    cg.add(var.set_burst_gap(config[CONF_BURST_GAP].total_microseconds))
+    cg.add(var.set_tile_size(config[CONF_TILE_SIZE]))
+    cg.add(var.set_serve_stale(config[CONF_SERVE_STALE]))
+    cg.add(var.set_max_wait(config[CONF_MAX_WAIT].total_milliseconds))
+    cg.add(var.set_cache_size(config[CONF_CACHE_SIZE]))
+    cg.add(var.set_auto_policy(config[CONF_AUTO_POLICY]))
+    cg.add(var.set_link_speed(config[CONF_LINK_SPEED]))
+    cg.add(var.set_serial_console(config[CONF_SERIAL_CONSOLE]))
+    if CONF_SHARED_MEMORY in config:
+        cg.add(var.set_shared_memory(config[CONF_SHARED_MEMORY]))
 
     # Native pages mode: resolve each DisplayPage ID and pass as a vector
     if CONF_PAGES in config:
@@ -92,7 +284,11 @@ async def to_code(config):
     # component's headers in the build when that component is used, so the
     # globals_component.h header won't exist in builds without globals.
     # We set a C++ define so the .cpp can #ifdef around the include and code.
-    if CONF_PAGE_GLOBAL in config or CONF_SLEEP_GLOBAL in config:
+    if (
+        CONF_PAGE_GLOBAL in config
+        or CONF_SLEEP_GLOBAL in config
+        or CONF_SWEEP in config
+    ):
         cg.add_define("DISPLAY_CAPTURE_USE_GLOBALS")
 
     if CONF_PAGE_GLOBAL in config:
@@ -106,3 +302,27 @@ async def to_code(config):
     if CONF_PAGE_NAMES in config:
         for name in config[CONF_PAGE_NAMES]:
             cg.add(var.add_page_name(name))
+
+    for axis in config.get(CONF_SWEEP, []):
+        glob = await cg.get_variable(axis[CONF_GLOBAL])
+        cg.add(var.add_sweep_global(glob, axis[CONF_GLOBAL].id, axis[CONF_VALUES]))
+
+
+@automation.register_action(
+    "display_capture.serial_capture",
+    SerialCaptureAction,
+    cv.Schema(
+        {
+            cv.GenerateID(): cv.use_id(DisplayCaptureHandler),
+            cv.Optional(CONF_PAGE): cv.templatable(cv.int_),
+        }
+    ),
+)
+async def serial_capture_to_code(config, action_id, template_arg, args):
+    """Streams a screenshot over the serial console (see serial_protocol.h)."""
+    var = cg.new_Pvariable(action_id, template_arg)
+    await cg.register_parented(var, config[CONF_ID])
+    if CONF_PAGE in config:
+        page = await cg.templatable(config[CONF_PAGE], args, cg.int_)
+        cg.add(var.set_page(page))
+    return var
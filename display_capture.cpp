@@ -1,27 +1,14 @@
 // display_capture -- implementation file.
 //
-// IMPORTANT: The #define protected public hack MUST be the very first thing
-// in this file, before any #include. It makes DisplayBuffer::buffer_ accessible
-// in this translation unit only. The .h file uses forward declarations so it
-// compiles cleanly without this hack.
-//
-// This works because each .cpp is a separate translation unit with its own
-// #pragma once state. The macro only affects headers included in THIS file.
+// Only public display APIs are used here. The framebuffer itself is reached
+// through a FramebufferBackend; the backends that need the #define protected
+// public hack live in framebuffer_backends.cpp.
 
-// --- Step 1: Expose protected members for buffer access ---
-#define protected public
-#include "esphome/components/display/display_buffer.h"
+// --- Step 1: Display API and our own header ---
 #include "esphome/components/display/display.h"
-#undef protected
-
-#ifdef USE_RPI_DPI_RGB
-#include "esphome/components/rpi_dpi_rgb/rpi_dpi_rgb.h"
-#endif
-
-// --- Step 2: Our own header (uses only forward declarations, no buffer access) ---
 #include "display_capture.h"
 
-// --- Step 3: Globals support (conditionally compiled) ---
+// --- Step 2: Globals support (conditionally compiled) ---
 // DISPLAY_CAPTURE_USE_GLOBALS is defined by __init__.py when page_global or
 // sleep_global are configured. Without this guard, the build fails when globals
 // aren't used because ESPHome doesn't copy globals headers to the build directory.
@@ -29,7 +16,22 @@
 #include "esphome/components/globals/globals_component.h"
 #endif
 
-#include <esp_heap_caps.h>
+#include "esphome/core/hal.h"
+
+// --- Step 3: The logger's UART, for console commands (see serial_read_()) ---
+#if defined(USE_ESP32) && defined(USE_LOGGER)
+#include "esphome/components/logger/logger.h"
+#include <driver/uart.h>
+#endif
+
+#ifndef USE_HOST
+#include <esp_heap_caps.h>  // host builds get heap_caps_*() from host_shims.h
+#endif
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
 #include <cstring>
 
 namespace esphome {
@@ -43,6 +45,8 @@ void DisplayCaptureHandler::setup() {
   // Binary semaphore for HTTP task <-> main loop synchronization.
   // The HTTP handler takes it (blocks), the main loop gives it (unblocks).
   this->semaphore_ = xSemaphoreCreateBinary();
+  // Mutex for the state both tasks touch: the pending request and the frame.
+  this->frame_lock_ = xSemaphoreCreateMutex();
   this->base_->init();
   this->base_->add_handler(this);
 
@@ -52,9 +56,51 @@ void DisplayCaptureHandler::setup() {
   else if (this->page_mode_ == GLOBAL_PAGES)
     mode_str = "global_pages";
 
-  const char *backend_str = "display_buffer";
-  if (this->backend_ == BACKEND_RPI_DPI_RGB)
-    backend_str = "rpi_dpi_rgb";
+  const char *backend_str = this->backend_ != nullptr ? this->backend_->get_name() : "none";
+
+  if (this->serial_console_) {
+#if defined(USE_ESP32) && defined(USE_LOGGER)
+    // The logger's UART driver takes every received byte into its own buffer,
+    // so stdin would see next to nothing: read through the driver instead.
+    if (logger::global_logger != nullptr) {
+      logger::UARTSelection uart = logger::global_logger->get_uart();
+      int port = uart == logger::UART_SELECTION_UART0 ? 0 : uart == logger::UART_SELECTION_UART1 ? 1 : -1;
+      if (port >= 0 && uart_is_driver_installed((uart_port_t) port))
+        this->serial_uart_ = port;
+    }
+#endif
+    if (this->serial_uart_ < 0) {
+      // Console commands are polled from loop(), so reads must never block.
+      // on_shutdown() puts the flags back.
+      int flags = fcntl(STDIN_FILENO, F_GETFL, 0);
+      if (flags < 0 || fcntl(STDIN_FILENO, F_SETFL, flags | O_NONBLOCK) < 0) {
+        ESP_LOGW(TAG, "Serial console input unavailable; use the serial_capture action instead");
+        this->serial_console_ = false;
+      } else {
+        this->stdin_flags_ = flags;
+      }
+    }
+    if (this->serial_console_)
+      ESP_LOGI(TAG, "Serial console: send \"screenshot [page]\" for a capture over this port");
+  }
+
+  if (this->cache_budget_ > 0) {
+    ESP_LOGI(TAG, "Response cache: %u KB of PSRAM", (unsigned) (this->cache_budget_ / 1024));
+  }
+
+#ifdef USE_HOST
+  if (!this->shm_name_.empty()) {
+    if (this->shm_writer_.open(this->shm_name_.c_str())) {
+      ESP_LOGI(TAG, "Shared-memory framebuffer: %s", this->shm_name_.c_str());
+    } else {
+      ESP_LOGW(TAG, "Shared-memory framebuffer %s unavailable: %s", this->shm_name_.c_str(), strerror(errno));
+    }
+  }
+#endif
+
+  if (this->read_mode_ == READ_THROTTLED) {
+    ESP_LOGI(TAG, "Throttled reads: %u rows per burst, %u us gap", this->burst_rows_, this->burst_gap_us_);
+  }
 
   int pages = this->get_page_count();
   if (pages >= 0) {
@@ -64,6 +110,14 @@ void DisplayCaptureHandler::setup() {
   }
 }
 
+void DisplayCaptureHandler::on_shutdown() {
+  // A host build runs in the user's terminal; hand stdin back as it was.
+  if (this->stdin_flags_ >= 0) {
+    fcntl(STDIN_FILENO, F_SETFL, this->stdin_flags_);
+    this->stdin_flags_ = -1;
+  }
+}
+
 int DisplayCaptureHandler::get_page_count() const {
   switch (this->page_mode_) {
     case NATIVE_PAGES:
@@ -85,7 +139,9 @@ int DisplayCaptureHandler::get_page_count() const {
 //
 // This is where all display buffer access happens. The HTTP task sets
 // request_pending_ and blocks on the semaphore. We do the work here
-// (where it's safe to touch display state) and signal when done.
+// (where it's safe to touch display state) and signal when done. The HTTP
+// task may have stopped waiting (it served the previous frame instead); the
+// capture still runs and becomes the frame the next request finds.
 //
 // Sequence:
 //   1. Wake display if sleeping (global pages mode)
@@ -95,28 +151,101 @@ int DisplayCaptureHandler::get_page_count() const {
 //   5. Restore original page and sleep state
 //   6. Re-render to put the display back: display_->update()
 //   7. Signal semaphore -- HTTP task unblocks and sends the BMP
+//
+// A sweep runs steps 3-4 once per state, one state per loop() pass so other
+// components keep running between renders, and only restores at the end.
+//
+// Serial captures (see "Serial transport" below) take the same steps without
+// an HTTP task waiting; sending their packets is spread over later passes and
+// runs alongside everything else.
 
 void DisplayCaptureHandler::loop() {
+#ifdef USE_HOST
+  // Captures restore the screen within their pass, so this sees what is on
+  // screen -- except mid-sweep, where the display shows a sweep state.
+  if (this->shm_writer_.is_open() && !this->sweep_active_)
+    this->shm_publish_();
+#endif
+  if (this->serial_console_)
+    this->serial_poll_console_();
+  if (this->serial_tx_.active())
+    this->serial_send_step_();
+
+  if (this->sweep_active_) {
+    this->sweep_step_();
+    return;
+  }
+
+  if (this->serial_pending_ && !this->serial_tx_.active()) {
+    this->serial_capture_();
+    return;  // a pending HTTP request runs on the next pass
+  }
+
   if (!this->request_pending_)
     return;
+  xSemaphoreTake(this->frame_lock_, portMAX_DELAY);
+  this->active_request_ = this->request_;
   this->request_pending_ = false;
+  xSemaphoreGive(this->frame_lock_);
+
+  this->enter_capture_state_();
+
+  if (this->active_request_.kind == REQUEST_SWEEP) {
+    if (this->begin_sweep_())
+      return;  // sweep_step_() takes over on the next loop() passes
+    this->leave_capture_state_(false);
+    this->complete_request_(false);
+    return;
+  }
+
+  // --- Render + capture ---
+  this->display_->update();
+  bool ok = this->generate_bmp_();
+
+  this->leave_capture_state_(false);
 
-  bool was_sleeping = false;
-  bool page_switched = false;
+  // Request-to-frame time, as the HTTP task sees it. Smoothed over ~8
+  // captures; it sets how long the next request waits before serving stale.
+  if (ok) {
+    uint32_t elapsed_ms = millis() - this->active_request_.requested_ms;
+    if (this->capture_ms_ewma_ == 0) {
+      this->capture_ms_ewma_ = std::max<uint32_t>(elapsed_ms, 1);
+    } else {
+      this->capture_ms_ewma_ = (this->capture_ms_ewma_ * 7 + elapsed_ms) / 8;
+    }
+  }
+
+  // Unblock the HTTP handler -- it can now send the BMP response.
+  this->complete_request_(ok);
+}
+
+void DisplayCaptureHandler::complete_request_(bool ok) {
+  // Written together, so a handler never pairs one capture's number with
+  // another's outcome.
+  xSemaphoreTake(this->frame_lock_, portMAX_DELAY);
+  this->completed_ok_ = ok;
+  this->completed_seq_ = this->active_request_.seq;
+  xSemaphoreGive(this->frame_lock_);
+  xSemaphoreGive(this->semaphore_);
+}
+
+void DisplayCaptureHandler::enter_capture_state_() {
+  this->was_sleeping_ = false;
+  this->page_switched_ = false;
 
   // --- Wake display if sleeping ---
 #ifdef DISPLAY_CAPTURE_USE_GLOBALS
   if (this->sleep_global_ != nullptr && this->sleep_global_->value()) {
-    was_sleeping = true;
+    this->was_sleeping_ = true;
     this->sleep_global_->value() = false;
   }
 #endif
 
   // --- Switch to requested page ---
-  if (this->requested_page_ >= 0) {
+  if (this->active_request_.page >= 0) {
     switch (this->page_mode_) {
       case NATIVE_PAGES: {
-        int idx = this->requested_page_;
+        int idx = this->active_request_.page;
         if (idx >= 0 && idx < (int) this->pages_.size()) {
           // Save active page so we can restore it after capture.
           // get_active_page() returns const*, show_page() takes non-const* --
@@ -124,16 +253,16 @@ void DisplayCaptureHandler::loop() {
           // back a page that was already active.
           this->saved_native_page_ = this->display_->get_active_page();
           this->display_->show_page(this->pages_[idx]);
-          page_switched = true;
+          this->page_switched_ = true;
         }
         break;
       }
 #ifdef DISPLAY_CAPTURE_USE_GLOBALS
       case GLOBAL_PAGES: {
         this->saved_global_page_ = this->page_global_->value();
-        if (this->saved_global_page_ != this->requested_page_) {
-          this->page_global_->value() = this->requested_page_;
-          page_switched = true;
+        if (this->saved_global_page_ != this->active_request_.page) {
+          this->page_global_->value() = this->active_request_.page;
+          this->page_switched_ = true;
         }
         break;
       }
@@ -142,13 +271,11 @@ void DisplayCaptureHandler::loop() {
         break;
     }
   }
+}
 
-  // --- Render + capture ---
-  this->display_->update();
-  this->generate_bmp_();
-
+void DisplayCaptureHandler::leave_capture_state_(bool force_update) {
   // --- Restore original state ---
-  if (page_switched) {
+  if (this->page_switched_) {
     switch (this->page_mode_) {
       case NATIVE_PAGES:
         if (this->saved_native_page_ != nullptr) {
@@ -166,65 +293,714 @@ void DisplayCaptureHandler::loop() {
   }
 
 #ifdef DISPLAY_CAPTURE_USE_GLOBALS
-  if (was_sleeping) {
+  if (this->was_sleeping_) {
     this->sleep_global_->value() = true;
   }
 #endif
 
   // Re-render to put the physical display back to its original state.
   // This causes a brief (~50ms) flash of the captured page on the display.
-  if (page_switched || was_sleeping) {
+  if (force_update || this->page_switched_ || this->was_sleeping_) {
     this->display_->update();
   }
+}
 
-  // Unblock the HTTP handler -- it can now send the BMP response.
-  xSemaphoreGive(this->semaphore_);
+// ============================================================================
+// State sweep -- renders every combination of the configured sweep globals
+// ============================================================================
+//
+// The response is built in a single PSRAM allocation sized up front: every
+// BMP has the same size and every part header is known before the first
+// render. Layout (multipart/mixed, RFC 2046):
+//
+//   --<boundary>\r\n<part headers>\r\n\r\n<BMP>\r\n   (once per state)
+//   --<boundary>--\r\n
+
+size_t DisplayCaptureHandler::get_sweep_state_count() const {
+  size_t count = 1;
+  for (const auto &axis : this->sweep_axes_)
+    count *= axis.values.size();
+  return count;
+}
+
+int DisplayCaptureHandler::sweep_value_(size_t axis, size_t state) const {
+  // Mixed-radix decode with the last axis varying fastest, like nested loops
+  // in declaration order.
+  for (size_t i = this->sweep_axes_.size(); i-- > axis + 1;)
+    state /= this->sweep_axes_[i].values.size();
+  const auto &values = this->sweep_axes_[axis].values;
+  return values[state % values.size()];
+}
+
+std::string DisplayCaptureHandler::sweep_part_header_(size_t state) const {
+  // Filename encodes the state (e.g. "menu_cursor-1_alarm_on-0.bmp") so a
+  // client can save parts directly; X-Sweep-State carries the same values in
+  // a parseable form.
+  std::string filename;
+  std::string values;
+  for (size_t i = 0; i < this->sweep_axes_.size(); i++) {
+    std::string value = std::to_string(this->sweep_value_(i, state));
+    if (i > 0) {
+      filename += "_";
+      values += ";";
+    }
+    filename += this->sweep_axes_[i].name + "-" + value;
+    values += this->sweep_axes_[i].name + "=" + value;
+  }
+  if (filename.empty())
+    filename = "state" + std::to_string(state);
+
+  std::string header = "--";
+  header += SWEEP_BOUNDARY;
+  header += "\r\nContent-Type: image/bmp\r\nContent-Disposition: inline; filename=\"" + filename + ".bmp\"\r\n";
+  header += "X-Sweep-Index: " + std::to_string(state) + "\r\n";
+  if (!values.empty())
+    header += "X-Sweep-State: " + values + "\r\n";
+  header += "\r\n";
+  return header;
+}
+
+int DisplayCaptureHandler::get_sweep_global_(const SweepAxis &axis) const {
+#ifdef DISPLAY_CAPTURE_USE_GLOBALS
+  if (axis.int_global != nullptr)
+    return axis.int_global->value();
+  if (axis.bool_global != nullptr)
+    return axis.bool_global->value() ? 1 : 0;
+#endif
+  return 0;
+}
+
+void DisplayCaptureHandler::set_sweep_global_(const SweepAxis &axis, int value) {
+#ifdef DISPLAY_CAPTURE_USE_GLOBALS
+  if (axis.int_global != nullptr)
+    axis.int_global->value() = value;
+  if (axis.bool_global != nullptr)
+    axis.bool_global->value() = value != 0;
+#endif
+}
+
+bool DisplayCaptureHandler::begin_sweep_() {
+  // Free the previous sweep body. This is deferred from handle_sweep_()
+  // because the async web server may still be reading from it when that
+  // function returns; by the time the next sweep starts, it has been sent.
+  if (this->sweep_data_ != nullptr) {
+    heap_caps_free(this->sweep_data_);
+    this->sweep_data_ = nullptr;
+    this->sweep_size_ = 0;
+  }
+
+  size_t states = this->get_sweep_state_count();
+  size_t total = 0;
+  for (size_t i = 0; i < states; i++)
+    total += this->sweep_part_header_(i).size() + this->bmp_file_size_() + 2;
+  total += strlen(SWEEP_BOUNDARY) + 6;  // "--" boundary "--\r\n"
+
+  // Every state is held at once, so the sweep must fit in one PSRAM block.
+  // Say how many states would fit instead of failing with a bare 500.
+  this->sweep_error_.clear();
+  size_t largest = heap_caps_get_largest_free_block(MALLOC_CAP_SPIRAM);
+  if (total > largest) {
+    size_t per_state = total / states;
+    char msg[160];
+    snprintf(msg, sizeof(msg), "Sweep of %u states needs %u KB of PSRAM, largest free block is %u KB (room for %u states)",
+             (unsigned) states, (unsigned) (total / 1024), (unsigned) (largest / 1024), (unsigned) (largest / per_state));
+    ESP_LOGE(TAG, "%s", msg);
+    this->sweep_error_ = msg;
+    return false;
+  }
+
+  this->sweep_data_ = (uint8_t *) heap_caps_malloc(total, MALLOC_CAP_SPIRAM);
+  if (this->sweep_data_ == nullptr) {
+    ESP_LOGE(TAG, "Failed to allocate %u bytes in PSRAM for %u sweep states", (unsigned) total, (unsigned) states);
+    return false;
+  }
+  this->sweep_size_ = total;
+
+  for (auto &axis : this->sweep_axes_)
+    axis.saved_value = this->get_sweep_global_(axis);
+
+  this->sweep_state_ = 0;
+  this->sweep_offset_ = 0;
+  this->sweep_active_ = true;
+  ESP_LOGI(TAG, "Starting sweep over %u states (%u bytes)", (unsigned) states, (unsigned) total);
+  return true;
+}
+
+void DisplayCaptureHandler::sweep_step_() {
+  size_t states = this->get_sweep_state_count();
+  bool ok = true;
+
+  if (this->sweep_state_ < states) {
+    for (size_t i = 0; i < this->sweep_axes_.size(); i++)
+      this->set_sweep_global_(this->sweep_axes_[i], this->sweep_value_(i, this->sweep_state_));
+
+    this->display_->update();
+
+    std::string header = this->sweep_part_header_(this->sweep_state_);
+    memcpy(this->sweep_data_ + this->sweep_offset_, header.data(), header.size());
+    this->sweep_offset_ += header.size();
+    ok = this->write_bmp_(this->sweep_data_ + this->sweep_offset_);
+    this->sweep_offset_ += this->bmp_file_size_();
+    memcpy(this->sweep_data_ + this->sweep_offset_, "\r\n", 2);
+    this->sweep_offset_ += 2;
+    this->sweep_state_++;
+
+    if (ok && this->sweep_state_ < states)
+      return;  // next state on the next loop() pass
+  }
+
+  if (ok) {
+    std::string closing = "--";
+    closing += SWEEP_BOUNDARY;
+    closing += "--\r\n";
+    memcpy(this->sweep_data_ + this->sweep_offset_, closing.data(), closing.size());
+    ESP_LOGI(TAG, "Sweep complete (%u states, %u bytes)", (unsigned) states, (unsigned) this->sweep_size_);
+  } else {
+    // Framebuffer became unavailable mid-sweep -- report failure (500).
+    heap_caps_free(this->sweep_data_);
+    this->sweep_data_ = nullptr;
+    this->sweep_size_ = 0;
+  }
+
+  // Restore every swept global once, then page/sleep, and re-render.
+  for (const auto &axis : this->sweep_axes_)
+    this->set_sweep_global_(axis, axis.saved_value);
+  this->sweep_active_ = false;
+  this->leave_capture_state_(!this->sweep_axes_.empty());
+
+  this->complete_request_(ok);
+}
+
+// ============================================================================
+// Tiles -- fixed-size, content-hashed views of the last capture
+// ============================================================================
+//
+// Tile hashes are collected by a HashSink during every full-scale capture
+// (see frame_sinks.h for the zoom-level convention and how hashes propagate
+// up the pyramid). Downscaled tile pixels are only computed when a tile is
+// actually requested.
+
+TileGrid DisplayCaptureHandler::get_tile_grid_() const {
+  TileGrid grid;
+  grid.width = this->display_->get_width();
+  grid.height = this->display_->get_height();
+  grid.tile_size = this->tile_size_;
+  return grid;
+}
+
+uint32_t DisplayCaptureHandler::tile_bmp_size_(int z, int x, int y) const {
+  TileGrid grid = this->get_tile_grid_();
+  int tw = std::min<int>(this->tile_size_, grid.level_width(z) - x * this->tile_size_);
+  int th = std::min<int>(this->tile_size_, grid.level_height(z) - y * this->tile_size_);
+  return bmp_file_size(tw, th);
+}
+
+void DisplayCaptureHandler::write_tile_bmp_(const uint8_t *frame, int z, int x, int y, uint8_t *out) const {
+  int screen_w = this->display_->get_width();
+  int screen_h = this->display_->get_height();
+  int src_stride = bmp_row_stride(screen_w);
+  TileGrid grid = this->get_tile_grid_();
+  int scale = grid.scale(z);
+  int tw = std::min<int>(this->tile_size_, grid.level_width(z) - x * this->tile_size_);
+  int th = std::min<int>(this->tile_size_, grid.level_height(z) - y * this->tile_size_);
+  int out_stride = bmp_row_stride(tw);
+
+  write_bmp_header(out, tw, th);
+
+  for (int ty = 0; ty < th; ty++) {
+    uint8_t *out_row = out + 54 + (th - 1 - ty) * out_stride;
+    memset(out_row + tw * 3, 0, out_stride - tw * 3);
+    int fy0 = (y * this->tile_size_ + ty) * scale;
+    int fy1 = std::min(fy0 + scale, screen_h);
+    for (int tx = 0; tx < tw; tx++) {
+      // Box filter over the scale x scale block (clipped at the frame edge)
+      int fx0 = (x * this->tile_size_ + tx) * scale;
+      int fx1 = std::min(fx0 + scale, screen_w);
+      uint32_t sum[3] = {0, 0, 0};
+      for (int fy = fy0; fy < fy1; fy++) {
+        const uint8_t *src = frame + 54 + (screen_h - 1 - fy) * src_stride + fx0 * 3;
+        for (int fx = fx0; fx < fx1; fx++, src += 3) {
+          sum[0] += src[0];
+          sum[1] += src[1];
+          sum[2] += src[2];
+        }
+      }
+      uint32_t n = (fy1 - fy0) * (fx1 - fx0);
+      out_row[tx * 3 + 0] = sum[0] / n;
+      out_row[tx * 3 + 1] = sum[1] / n;
+      out_row[tx * 3 + 2] = sum[2] / n;
+    }
+  }
 }
 
 // ============================================================================
 // HTTP handlers -- run on the web server's FreeRTOS task
 // ============================================================================
 
+std::string DisplayCaptureHandler::get_request_header_(AsyncWebServerRequest *req, const char *name) {
+#ifdef USE_ESP_IDF
+  auto value = req->get_header(name);
+  return value.has_value() ? value.value() : "";
+#else
+  if (!req->hasHeader(name))
+    return "";
+  return req->getHeader(name)->value().c_str();
+#endif
+}
+
+std::string DisplayCaptureHandler::format_etag_(uint32_t hash) {
+  char buf[12];
+  snprintf(buf, sizeof(buf), "\"%08x\"", (unsigned) hash);
+  return buf;
+}
+
+/// ?format= value of an output format.
+static const char *format_name(OutputFormat format) {
+  switch (format) {
+    case FORMAT_BMP16:
+      return "bmp16";
+    case FORMAT_RLE8:
+      return "rle8";
+    case FORMAT_AUTO:
+      return "auto";
+    default:
+      return "bmp";
+  }
+}
+
+/// Whether two requests produce the same image from the same screen content:
+/// same format, scale and region.
+static bool same_output_shape(const CaptureRequest &a, const CaptureRequest &b) {
+  return a.format == b.format && a.scale == b.scale && a.region_x == b.region_x && a.region_y == b.region_y &&
+         a.region_w == b.region_w && a.region_h == b.region_h;
+}
+
+/// Stale frames may stand in for a request only if they carry what it asked
+/// for: same page and output shape, stats if requested, and the same watch region.
+static bool frame_serves_request(const CaptureRequest &frame, const CaptureRequest &request) {
+  return frame.kind == REQUEST_SCREENSHOT && frame.page == request.page && same_output_shape(frame, request) &&
+         (frame.stats || !request.stats) && frame.watch_x == request.watch_x && frame.watch_y == request.watch_y &&
+         frame.watch_w == request.watch_w && frame.watch_h == request.watch_h;
+}
+
 /// Screenshot handler: sets a flag for the main loop and blocks until the
 /// BMP is ready. The 5-second timeout prevents deadlocks if the main loop
 /// is stuck or the component is misconfigured.
 ///
+/// Stale-while-revalidate: when the last frame matches the request, the wait
+/// is cut to what the capture normally takes (1.5x the smoothed
+/// request-to-frame time, capped at max_wait). If that passes -- or the capture
+/// is known to be slower than max_wait -- the last frame is sent right away
+/// with an Age header, and the capture carries on in loop() so the next
+/// request gets a newer frame. A failed capture also falls back to it.
+/// ?fresh=1 or a request Cache-Control of no-cache / max-age=0 always waits.
+///
+/// Every BMP carries an ETag: the hash of the screen content, mixed with the
+/// scale, encoded format and region. If the client sends a matching
+/// If-None-Match, we still have to render and read the framebuffer to know the
+/// hash, but answer 304 without a body -- unchanged pages cost no transfer.
+///
+/// Optional parameters attach extra sinks to the same framebuffer pass:
+///   ?format=bmp16    -- return a 16-bit RGB565 BMP instead of a 24-bit one
+///   ?format=rle8     -- return an RLE-compressed 8-bit palette BMP (bmp16 above 256 colours)
+///   ?format=auto     -- let the device pick per page (X-Frame-Format names the choice)
+///   ?scale=2|4|8     -- return a box-filtered thumbnail instead of the full frame
+///   ?region=x,y,w,h  -- return only that screen rectangle (scaled, if ?scale is given)
+///   ?stats=1         -- add X-Frame-Colors / X-Frame-Runs (distinct colours, runs)
+///   ?watch=x,y,w,h   -- add X-Watch-Hash, a hash of that screen region only
+///
 /// IMPORTANT: After req->send(), the web server may still be reading from
-/// bmp_data_ asynchronously (ESPAsyncWebServer on Arduino does not copy
-/// the buffer). We do NOT free the buffer here -- it is freed at the start
-/// of the next generate_bmp_() call, by which time the response is
-/// guaranteed to have been sent. The ~225 KB PSRAM cost between requests
-/// is negligible on devices with 2-8 MB PSRAM.
+/// the frame buffer asynchronously (ESPAsyncWebServer on Arduino does not
+/// copy the buffer). We do NOT free the buffer here -- when a newer capture
+/// replaces it, it is retired and freed one capture later, and never while
+/// this task is inside send (see retire_frame_data_()). Up to three frames
+/// can be in PSRAM at once, which is negligible on devices with 2-8 MB PSRAM,
+/// plus the response cache (cache_size), which shares buffers with them.
 void DisplayCaptureHandler::handle_screenshot_(AsyncWebServerRequest *req) {
-  int requested_page = -1;
+  CaptureRequest request;
   if (req->hasParam("page")) {
-    requested_page = atoi(req->arg("page").c_str());
+    request.page = atoi(req->arg("page").c_str());
+  }
+  if (req->hasParam("scale")) {
+    request.scale = atoi(req->arg("scale").c_str());
+    if (request.scale != 1 && request.scale != 2 && request.scale != 4 && request.scale != 8) {
+      req->send(400, "text/plain", "scale must be 1, 2, 4 or 8");
+      return;
+    }
   }
+  if (req->hasParam("format")) {
+    std::string format = req->arg("format").c_str();
+    int f = 0;
+    while (f <= FORMAT_AUTO && format != format_name((OutputFormat) f))
+      f++;
+    if (f > FORMAT_AUTO) {
+      req->send(400, "text/plain", "format must be bmp, bmp16, rle8 or auto");
+      return;
+    }
+    request.format = (OutputFormat) f;
+  }
+  if (req->hasParam("region")) {
+    if (sscanf(req->arg("region").c_str(), "%d,%d,%d,%d", &request.region_x, &request.region_y, &request.region_w,
+               &request.region_h) != 4 ||
+        request.region_x < 0 || request.region_y < 0 || request.region_w <= 0 || request.region_h <= 0 ||
+        request.region_x + request.region_w > this->display_->get_width() ||
+        request.region_y + request.region_h > this->display_->get_height()) {
+      req->send(400, "text/plain", "region must be x,y,w,h inside the screen");
+      return;
+    }
+  }
+  if (req->hasParam("stats")) {
+    request.stats = req->arg("stats") == "1";
+  }
+  if (req->hasParam("watch")) {
+    if (sscanf(req->arg("watch").c_str(), "%d,%d,%d,%d", &request.watch_x, &request.watch_y, &request.watch_w,
+               &request.watch_h) != 4 ||
+        request.watch_w <= 0 || request.watch_h <= 0) {
+      req->send(400, "text/plain", "watch must be x,y,w,h");
+      return;
+    }
+  }
+
+  // Clients that must see the current screen (crawlers, regression checks)
+  // opt out of stale frames with ?fresh=1 or a request Cache-Control of
+  // no-cache / max-age=0.
+  std::string cache_control = get_request_header_(req, "Cache-Control");
+  bool want_fresh = (req->hasParam("fresh") && req->arg("fresh") == "1") ||
+                    cache_control.find("no-cache") != std::string::npos ||
+                    cache_control.find("max-age=0") != std::string::npos;
+
+  CapturedFrame stale = this->snapshot_frame_(false);
+  bool can_serve_stale = this->serve_stale_ && !want_fresh && stale.data != nullptr &&
+                         frame_serves_request(stale.request, request);
+  uint32_t wait_ms = this->get_fresh_deadline_ms_(can_serve_stale ? &stale : nullptr);
+
+  uint32_t seq;
+  bool captured = this->request_capture_(request, wait_ms, !can_serve_stale, &seq);
+  // Another request's capture may have finished since ours: read the outcome
+  // with the frame it left behind. A later capture's frame still counts as
+  // fresh if it serves this request.
+  bool fresh = false;
+  CapturedFrame frame;
+  if (captured) {
+    xSemaphoreTake(this->frame_lock_, portMAX_DELAY);
+    frame = this->frame_;
+    fresh = this->completed_ok_ && (this->completed_seq_ == seq || frame_serves_request(frame.request, request));
+    if (fresh)
+      this->frame_in_flight_ = frame.data;
+    xSemaphoreGive(this->frame_lock_);
+  }
+  if (fresh) {
+    this->served_fresh_++;
+    this->send_frame_(req, frame, false);
+    this->end_send_();
+    return;
+  }
+
+  if (can_serve_stale) {
+    // Re-read the frame: a capture that finished meanwhile is newer. It only
+    // stops matching if another request's capture replaced it.
+    CapturedFrame frame = this->snapshot_frame_(true);
+    if (frame.data != nullptr && frame_serves_request(frame.request, request)) {
+      this->served_stale_++;
+      this->send_frame_(req, frame, true);
+      this->end_send_();
+      return;
+    }
+    this->end_send_();
+  }
+
+  if (captured) {
+    req->send(500, "text/plain", "Failed to capture screenshot");
+  } else {
+    this->served_timeout_++;
+    req->send(504, "text/plain", "Screenshot capture timed out");
+  }
+}
 
-  this->requested_page_ = requested_page;
+uint32_t DisplayCaptureHandler::get_fresh_deadline_ms_(const CapturedFrame *stale) const {
+  if (stale == nullptr)
+    return 5000;  // nothing to fall back on -- wait as long as it takes
+  uint32_t expected_ms = this->capture_ms_ewma_;
+  if (expected_ms == 0)
+    return this->max_wait_ms_;  // no measurement yet
+  if (expected_ms >= this->max_wait_ms_)
+    return 0;  // would miss the deadline anyway -- don't make the client wait
+  return std::min(this->max_wait_ms_, expected_ms * 3 / 2 + 20);
+}
+
+CapturedFrame DisplayCaptureHandler::snapshot_frame_(bool sending) {
+  xSemaphoreTake(this->frame_lock_, portMAX_DELAY);
+  CapturedFrame frame = this->frame_;
+  if (sending)
+    this->frame_in_flight_ = frame.data;
+  xSemaphoreGive(this->frame_lock_);
+  return frame;
+}
+
+void DisplayCaptureHandler::end_send_() {
+  xSemaphoreTake(this->frame_lock_, portMAX_DELAY);
+  this->frame_in_flight_ = nullptr;
+  xSemaphoreGive(this->frame_lock_);
+}
+
+void DisplayCaptureHandler::send_frame_(AsyncWebServerRequest *req, const CapturedFrame &frame, bool stale) {
+  std::string etag = format_etag_(frame.hash);
+  std::string if_none_match = get_request_header_(req, "If-None-Match");
+  AsyncWebServerResponse *response;
+  // A stale frame says nothing about the current screen, so it is never a 304.
+  if (!stale && !if_none_match.empty() && if_none_match.find(etag) != std::string::npos) {
+    response = req->beginResponse(304, "image/bmp");
+  } else {
+#ifdef USE_ESP_IDF
+    response = req->beginResponse_P(200, "image/bmp", frame.data, frame.size);
+#else
+    response = req->beginResponse(200, "image/bmp", frame.data, frame.size);
+#endif
+  }
+  add_capture_headers_(response, frame, etag);
+  if (stale) {
+    char age[12];
+    snprintf(age, sizeof(age), "%u", (unsigned) ((millis() - frame.captured_ms) / 1000));
+    response->addHeader("Age", age);
+  }
+  req->send(response);
+  // Buffer is intentionally NOT freed here. See comment above.
+}
+
+void DisplayCaptureHandler::add_capture_headers_(AsyncWebServerResponse *response, const CapturedFrame &frame,
+                                                 const std::string &etag) {
+  char value[12];
+  response->addHeader("ETag", etag.c_str());
+  response->addHeader("Cache-Control", "no-cache");
+  if (frame.request.format != FORMAT_BMP)
+    response->addHeader("X-Frame-Format", format_name(frame.encoded_format));
+  if (frame.request.stats) {
+    snprintf(value, sizeof(value), "%u", (unsigned) frame.colors);
+    response->addHeader("X-Frame-Colors", value);
+    snprintf(value, sizeof(value), "%u", (unsigned) frame.runs);
+    response->addHeader("X-Frame-Runs", value);
+  }
+  if (frame.request.watch_w > 0) {
+    snprintf(value, sizeof(value), "%08x", (unsigned) frame.watch_hash);
+    response->addHeader("X-Watch-Hash", value);
+  }
+}
+
+/// Queues the request for the main loop and blocks on the semaphore until
+/// loop() reports it (or a later request) done. The semaphore may have been
+/// given for a capture an earlier caller stopped waiting for, hence the
+/// sequence check. On timeout the request is withdrawn if loop() hasn't
+/// picked it up yet, unless `cancel_on_timeout` is false.
+bool DisplayCaptureHandler::request_capture_(const CaptureRequest &request, uint32_t timeout_ms,
+                                             bool cancel_on_timeout, uint32_t *seq_out) {
+  uint32_t start_ms = millis();
+  xSemaphoreTake(this->frame_lock_, portMAX_DELAY);
+  uint32_t seq = ++this->request_seq_;
+  if (seq_out != nullptr)
+    *seq_out = seq;
+  this->request_ = request;
+  this->request_.seq = seq;
+  this->request_.requested_ms = start_ms;
   this->request_pending_ = true;
+  xSemaphoreGive(this->frame_lock_);
+
+  while ((int32_t) (this->completed_seq_ - seq) < 0) {
+    uint32_t elapsed_ms = millis() - start_ms;
+    if (elapsed_ms >= timeout_ms ||
+        xSemaphoreTake(this->semaphore_, pdMS_TO_TICKS(timeout_ms - elapsed_ms)) != pdTRUE) {
+      if (cancel_on_timeout) {
+        xSemaphoreTake(this->frame_lock_, portMAX_DELAY);
+        if (this->request_.seq == seq)
+          this->request_pending_ = false;
+        xSemaphoreGive(this->frame_lock_);
+      }
+      return false;
+    }
+  }
+  return true;
+}
+
+/// Sweep handler: same handoff as handle_screenshot_(), but the main loop
+/// renders every sweep state before giving the semaphore, so the timeout is
+/// extended by one second per state. The body has its own buffer, freed when
+/// the next sweep starts; sweeps never serve stale.
+void DisplayCaptureHandler::handle_sweep_(AsyncWebServerRequest *req) {
+  CaptureRequest request;
+  request.kind = REQUEST_SWEEP;
+  if (req->hasParam("page")) {
+    request.page = atoi(req->arg("page").c_str());
+  }
 
-  if (xSemaphoreTake(this->semaphore_, pdMS_TO_TICKS(5000)) == pdTRUE) {
-    if (this->bmp_data_ != nullptr && this->bmp_size_ > 0) {
+  uint32_t timeout_ms = 5000 + 1000 * this->get_sweep_state_count();
+  if (this->request_capture_(request, timeout_ms)) {
+    if (this->completed_ok_ && this->sweep_data_ != nullptr && this->sweep_size_ > 0) {
+      std::string content_type = "multipart/mixed; boundary=";
+      content_type += SWEEP_BOUNDARY;
 #ifdef USE_ESP_IDF
-      auto *response = req->beginResponse_P(200, "image/bmp", this->bmp_data_, this->bmp_size_);
+      auto *response = req->beginResponse_P(200, content_type.c_str(), this->sweep_data_, this->sweep_size_);
 #else
-      auto *response = req->beginResponse(200, "image/bmp", this->bmp_data_, this->bmp_size_);
+      auto *response = req->beginResponse(200, content_type.c_str(), this->sweep_data_, this->sweep_size_);
 #endif
       response->addHeader("Cache-Control", "no-cache");
       req->send(response);
-      // Buffer is intentionally NOT freed here. See comment above.
+    } else if (!this->sweep_error_.empty()) {
+      req->send(500, "text/plain", this->sweep_error_.c_str());
     } else {
-      req->send(500, "text/plain", "Failed to capture screenshot");
+      req->send(500, "text/plain", "Failed to capture sweep");
     }
   } else {
-    this->request_pending_ = false;
+    req->send(504, "text/plain", "Sweep capture timed out");
+  }
+}
+
+/// Tile index handler: captures like /screenshot (including ?page=N) and
+/// returns the tile hashes collected during that capture. A viewer compares them
+/// with its previous index and refetches only tiles whose hash changed.
+///
+/// Response format:
+///   {"width":320,"height":240,"tile_size":64,"max_zoom":3,"frame":"1a2b3c4d",
+///    "levels":[{"z":0,"cols":1,"rows":1,"hashes":["9e3779b9"]},...]}
+void DisplayCaptureHandler::handle_tiles_(AsyncWebServerRequest *req) {
+  CaptureRequest request;
+  if (req->hasParam("page")) {
+    request.page = atoi(req->arg("page").c_str());
+  }
+
+  if (!this->request_capture_(request, 5000)) {
     req->send(504, "text/plain", "Screenshot capture timed out");
+    return;
+  }
+
+  char hex[12];
+  TileGrid grid = this->get_tile_grid_();
+  int max_z = grid.max_zoom();
+  std::string json = "{";
+  json += "\"width\":" + std::to_string(this->display_->get_width());
+  json += ",\"height\":" + std::to_string(this->display_->get_height());
+  json += ",\"tile_size\":" + std::to_string(this->tile_size_);
+  json += ",\"max_zoom\":" + std::to_string(max_z);
+
+  // The hashes are replaced together with the frame, so read them under the lock.
+  xSemaphoreTake(this->frame_lock_, portMAX_DELAY);
+  if (!this->completed_ok_ || !this->tiles_valid_) {
+    xSemaphoreGive(this->frame_lock_);
+    req->send(500, "text/plain", "Failed to capture screenshot");
+    return;
+  }
+  snprintf(hex, sizeof(hex), "%08x", (unsigned) this->frame_.hash);
+  json += ",\"frame\":\"";
+  json += hex;
+  json += "\",\"levels\":[";
+  for (int z = 0; z <= max_z; z++) {
+    if (z > 0)
+      json += ",";
+    json += "{\"z\":" + std::to_string(z);
+    json += ",\"cols\":" + std::to_string(grid.cols(z));
+    json += ",\"rows\":" + std::to_string(grid.rows(z));
+    json += ",\"hashes\":[";
+    const auto &hashes = this->tile_hashes_[z];
+    for (size_t i = 0; i < hashes.size(); i++) {
+      snprintf(hex, sizeof(hex), i > 0 ? ",\"%08x\"" : "\"%08x\"", (unsigned) hashes[i]);
+      json += hex;
+    }
+    json += "]}";
   }
+  json += "]}";
+  xSemaphoreGive(this->frame_lock_);
+
+  auto *response = req->beginResponse(200, "application/json", json.c_str());
+  response->addHeader("Cache-Control", "no-cache");
+  req->send(response);
+}
+
+/// Tile handler: serves one tile of the last capture. No render is needed --
+/// tiles are cut from the current frame, which stays allocated while this
+/// task marks it in flight. Tiles follow the last full-scale capture; after a
+/// ?scale=N capture (or before any capture) the current screen is captured
+/// first.
+///
+/// Caching: every tile has its hash as a strong ETag (304 on match). When the
+/// URL carries ?h=<hash> and it matches, the URL is content-addressed and is
+/// marked immutable for a year; otherwise the tile is no-cache.
+void DisplayCaptureHandler::handle_tile_(AsyncWebServerRequest *req) {
+  int z, x, y;
+  if (sscanf(req->url().c_str(), "/screenshot/tile/%d/%d/%d", &z, &x, &y) != 3) {
+    req->send(404, "text/plain", "Expected /screenshot/tile/{z}/{x}/{y}");
+    return;
+  }
+
+  // loop() publishes frames concurrently; tiles_valid_ is only read under the lock.
+  xSemaphoreTake(this->frame_lock_, portMAX_DELAY);
+  bool have_tiles = this->tiles_valid_;
+  xSemaphoreGive(this->frame_lock_);
+  if (!have_tiles && !this->request_capture_(CaptureRequest(), 5000)) {
+    req->send(504, "text/plain", "Screenshot capture timed out");
+    return;
+  }
+
+  TileGrid grid = this->get_tile_grid_();
+  if (z < 0 || z > grid.max_zoom() || x < 0 || x >= grid.cols(z) || y < 0 || y >= grid.rows(z)) {
+    req->send(404, "text/plain", "No such tile");
+    return;
+  }
+
+  // Pin the frame and read the tile's hash together, so both describe the same capture.
+  xSemaphoreTake(this->frame_lock_, portMAX_DELAY);
+  bool valid = this->tiles_valid_;
+  const uint8_t *frame = this->frame_.data;
+  uint32_t hash = valid ? this->tile_hashes_[z][y * grid.cols(z) + x] : 0;
+  if (valid)
+    this->frame_in_flight_ = frame;
+  xSemaphoreGive(this->frame_lock_);
+  if (!valid) {
+    req->send(500, "text/plain", "Failed to capture screenshot");
+    return;
+  }
+
+  char hex[12];
+  snprintf(hex, sizeof(hex), "%08x", (unsigned) hash);
+  std::string etag = format_etag_(hash);
+  const char *cache_control = "no-cache";
+  if (req->hasParam("h") && req->arg("h") == hex)
+    cache_control = "public, max-age=31536000, immutable";
+
+  std::string if_none_match = get_request_header_(req, "If-None-Match");
+  if (!if_none_match.empty() && if_none_match.find(etag) != std::string::npos) {
+    this->end_send_();
+    auto *response = req->beginResponse(304, "image/bmp");
+    response->addHeader("ETag", etag.c_str());
+    response->addHeader("Cache-Control", cache_control);
+    req->send(response);
+    return;
+  }
+
+  uint32_t size = this->tile_bmp_size_(z, x, y);
+  auto *tile = (uint8_t *) heap_caps_malloc(size, MALLOC_CAP_SPIRAM);
+  if (tile == nullptr) {
+    this->end_send_();
+    req->send(500, "text/plain", "Failed to allocate tile");
+    return;
+  }
+  this->write_tile_bmp_(frame, z, x, y, tile);
+  this->end_send_();
+
+  // Unlike the full frame, tiles are freed right away: the IDF server sends
+  // synchronously, and on Arduino the stream response copies the bytes.
+#ifdef USE_ESP_IDF
+  auto *response = req->beginResponse_P(200, "image/bmp", tile, size);
+#else
+  auto *response = req->beginResponseStream("image/bmp");
+  response->write(tile, size);
+#endif
+  response->addHeader("ETag", etag.c_str());
+  response->addHeader("Cache-Control", cache_control);
+  req->send(response);
+  heap_caps_free(tile);
 }
 
 /// Info handler: returns JSON metadata about the display and page configuration.
-/// Runs synchronously on the HTTP task -- all data is immutable after setup.
+/// Runs synchronously on the HTTP task. Setup-time data and the last capture's
+/// timings are read directly; cache and auto-format state under frame_lock_.
 ///
 /// Response format:
 ///   {"pages":3,"width":320,"height":240,"mode":"native_pages","page_names":["Main","Graph","Settings"]}
@@ -251,6 +1027,47 @@ void DisplayCaptureHandler::handle_info_(AsyncWebServerRequest *req) {
   json += ",\"mode\":\"";
   json += mode_str;
   json += "\"";
+  json += ",\"backend\":\"";
+  json += this->backend_ != nullptr ? this->backend_->get_name() : "none";
+  json += "\"";
+  json += ",\"read_mode\":\"";
+  json += this->read_mode_ == READ_THROTTLED ? "throttled" : "direct";
+  json += "\"";
+  // Throughput of the most recent capture, once there has been one
+  if (this->last_capture_us_ > 0) {
+    json += ",\"last_capture\":{\"us\":" + std::to_string(this->last_capture_us_);
+    json += ",\"bytes\":" + std::to_string(this->last_capture_bytes_);
+    json += ",\"kbps\":" + std::to_string(this->get_capture_throughput_kbps());
+    json += ",\"ms_avg\":" + std::to_string(this->capture_ms_ewma_) + "}";
+  }
+  // How /screenshot requests were answered (see handle_screenshot_())
+  json += ",\"served\":{\"fresh\":" + std::to_string(this->served_fresh_);
+  json += ",\"stale\":" + std::to_string(this->served_stale_);
+  json += ",\"timeout\":" + std::to_string(this->served_timeout_) + "}";
+  if (this->cache_budget_ > 0) {
+    xSemaphoreTake(this->frame_lock_, portMAX_DELAY);
+    json += ",\"cache\":{\"entries\":" + std::to_string(this->cache_.size());
+    json += ",\"bytes\":" + std::to_string(this->cache_bytes_);
+    xSemaphoreGive(this->frame_lock_);
+    json += ",\"budget\":" + std::to_string(this->cache_budget_);
+    json += ",\"hits\":" + std::to_string(this->cache_hits_);
+    json += ",\"misses\":" + std::to_string(this->cache_misses_) + "}";
+  }
+  // What ?format=auto has settled on for each page it has seen
+  xSemaphoreTake(this->frame_lock_, portMAX_DELAY);
+  if (!this->format_stats_.empty()) {
+    json += ",\"auto_formats\":[";
+    for (auto it = this->format_stats_.begin(); it != this->format_stats_.end(); ++it) {
+      if (it != this->format_stats_.begin())
+        json += ",";
+      json += "{\"page\":" + std::to_string(it->first);
+      json += ",\"format\":\"";
+      json += format_name(it->second.last_choice);
+      json += "\",\"colors\":" + std::to_string(it->second.colors) + "}";
+    }
+    json += "]";
+  }
+  xSemaphoreGive(this->frame_lock_);
 
   if (!this->page_names_.empty()) {
     json += ",\"page_names\":[";
@@ -284,11 +1101,203 @@ void DisplayCaptureHandler::handle_info_(AsyncWebServerRequest *req) {
     json += "]";
   }
 
+  // Sweep axes use YAML ids as names, which are already JSON-safe.
+  if (!this->sweep_axes_.empty()) {
+    json += ",\"sweep_states\":" + std::to_string(this->get_sweep_state_count());
+    json += ",\"sweep\":[";
+    for (size_t i = 0; i < this->sweep_axes_.size(); i++) {
+      if (i > 0)
+        json += ",";
+      json += "{\"global\":\"" + this->sweep_axes_[i].name + "\",\"values\":[";
+      for (size_t j = 0; j < this->sweep_axes_[i].values.size(); j++) {
+        if (j > 0)
+          json += ",";
+        json += std::to_string(this->sweep_axes_[i].values[j]);
+      }
+      json += "]}";
+    }
+    json += "]";
+  }
+
   json += "}";
 
   req->send(200, "application/json", json.c_str());
 }
 
+// ============================================================================
+// Serial transport -- screenshots over the console UART / USB-CDC
+// ============================================================================
+//
+// For devices without Wi-Fi headroom. A capture is encoded as RLE565 into
+// PSRAM in one framebuffer pass (like any other capture, on the main loop),
+// then sent as COBS-framed, CRC-checked packets (serial_protocol.h) over the
+// console that also carries the log. Sending is spread over loop() passes,
+// SERIAL_SEND_BUDGET_MS at a time, so other components keep running. Packets
+// go out from the main loop between log lines; a log line from another task
+// that lands inside a packet makes that packet fail its CRC on the host.
+//
+// tools/serial_receive.cpp triggers captures with the console command and
+// turns the packets back into a PNG.
+
+/// Longest a single loop() pass spends writing packets.
+static const uint32_t SERIAL_SEND_BUDGET_MS = 20;
+
+void DisplayCaptureHandler::serial_capture_() {
+  this->serial_pending_ = false;
+  int screen_w = this->display_->get_width();
+  int screen_h = this->display_->get_height();
+  size_t max_size = Rle565Sink::max_encoded_size(screen_w, screen_h);
+  // Only set while a frame is being sent, and loop() doesn't start one then;
+  // freed anyway so an interrupted send can't leak the previous frame.
+  heap_caps_free(this->serial_data_);
+  this->serial_data_ = (uint8_t *) heap_caps_malloc(max_size, MALLOC_CAP_SPIRAM);
+  if (this->serial_data_ == nullptr) {
+    ESP_LOGE(TAG, "Failed to allocate %u bytes in PSRAM for serial capture", (unsigned) max_size);
+    return;
+  }
+
+  CaptureRequest request;
+  request.page = this->serial_page_;
+  this->active_request_ = request;
+  this->enter_capture_state_();
+  this->display_->update();
+  Rle565Sink encoder(this->serial_data_);
+  bool ok = this->run_pipeline_({&encoder});
+  this->leave_capture_state_(false);
+
+  if (!ok) {
+    heap_caps_free(this->serial_data_);
+    this->serial_data_ = nullptr;
+    return;
+  }
+  ESP_LOGI(TAG, "Sending %dx%d frame over serial (%u bytes RLE565)", screen_w, screen_h,
+           (unsigned) encoder.get_size());
+  this->serial_tx_.begin(++this->serial_frame_id_, screen_w, screen_h, this->serial_data_, encoder.get_size());
+  this->serial_start_ms_ = millis();
+}
+
+void DisplayCaptureHandler::serial_send_step_() {
+  uint8_t wire[SERIAL_MAX_WIRE];
+  uint32_t start_ms = millis();
+  do {
+    size_t n = this->serial_tx_.next_packet(wire);
+    if (n > 0)
+      this->serial_write_(wire, n);
+    if (!this->serial_tx_.active()) {
+      // That was the END packet. Writes are synchronous, so the buffer can go
+      // right away -- not on a later pass, which loop() would never make.
+      size_t size = this->serial_tx_.get_offset();
+      heap_caps_free(this->serial_data_);
+      this->serial_data_ = nullptr;
+      ESP_LOGI(TAG, "Serial frame %u sent (%u bytes in %u ms)", (unsigned) this->serial_frame_id_, (unsigned) size,
+               (unsigned) (millis() - this->serial_start_ms_));
+      return;
+    }
+  } while (millis() - start_ms < SERIAL_SEND_BUDGET_MS);
+}
+
+void DisplayCaptureHandler::serial_write_(const uint8_t *data, size_t len) {
+  // Packets contain no "\n", so the console's line-ending translation leaves
+  // them intact. Anything printf()ed so far goes first, so packets never
+  // split a line.
+  fflush(stdout);
+  while (len > 0) {
+    ssize_t n = write(STDOUT_FILENO, data, len);
+    if (n < 0) {
+      if (errno == EAGAIN || errno == EINTR)
+        continue;
+      return;  // console gone -- the host sees a truncated frame
+    }
+    data += n;
+    len -= n;
+  }
+}
+
+int DisplayCaptureHandler::serial_read_(char *buf, size_t len) {
+#if defined(USE_ESP32) && defined(USE_LOGGER)
+  if (this->serial_uart_ >= 0)
+    return uart_read_bytes((uart_port_t) this->serial_uart_, buf, len, 0);
+#endif
+  return read(STDIN_FILENO, buf, len);
+}
+
+void DisplayCaptureHandler::serial_poll_console_() {
+  char buf[32];
+  int n;
+  while ((n = this->serial_read_(buf, sizeof(buf))) > 0) {
+    for (int i = 0; i < n; i++) {
+      char c = buf[i];
+      if (c != '\n' && c != '\r') {
+        if (this->serial_line_.size() < 64)
+          this->serial_line_ += c;
+        continue;
+      }
+      // Command: "screenshot" or "screenshot <page>". Anything else is ignored.
+      int page = -1;
+      const char *line = this->serial_line_.c_str();
+      if (strcmp(line, "screenshot") == 0 || sscanf(line, "screenshot %d", &page) == 1)
+        this->request_serial_capture(page);
+      this->serial_line_.clear();
+    }
+  }
+}
+
+#ifdef USE_HOST
+// ============================================================================
+// Shared-memory export -- live framebuffer for local tools (host builds)
+// ============================================================================
+//
+// Twice per display update interval (at most every SHM_MAX_POLL_MS), the
+// framebuffer is read and compared with the frame in the segment; when the
+// display has drawn something new, it is copied in under the seqlock
+// (ShmFrameWriter::publish_if_changed(), which the shm_view self-test
+// exercises). Readers get native rows in the framebuffer's own pixel format
+// plus the rotation: no conversion, no encoding. A poll costs the backend's
+// read -- for sdl a render-target copy and a GPU readback -- plus one memcmp,
+// which is why it isn't done on every loop() pass: the display only draws
+// on its update interval anyway. Frames land within half an interval of
+// each display update. tools/shm_view.cpp reads them.
+
+/// Longest time between polls, for displays that update rarely or never on
+/// their own (`update_interval: never`, pages switched by automations).
+static const uint32_t SHM_MAX_POLL_MS = 500;
+
+void DisplayCaptureHandler::shm_publish_() {
+  uint32_t now = millis();
+  if ((int32_t) (now - this->shm_next_poll_ms_) < 0)
+    return;
+  this->shm_next_poll_ms_ = now + std::min(this->display_->get_update_interval() / 2, SHM_MAX_POLL_MS);
+
+  FramebufferInfo fb;
+  if (this->backend_ == nullptr || !this->backend_->begin_capture(fb)) {
+    // begin_capture() logged why; don't repeat that on every pass.
+    ESP_LOGW(TAG, "Shared-memory export stopped");
+    this->shm_writer_.close();
+    return;
+  }
+
+  ShmFrameLayout layout;
+  layout.width = fb.width;
+  layout.height = fb.height;
+  layout.stride = fb.width * 2;
+  layout.format = SHM_FORMAT_RGB565;
+  layout.byte_order = fb.byte_order == BYTE_ORDER_BIG_ENDIAN ? SHM_BIG_ENDIAN : SHM_LITTLE_ENDIAN;
+  layout.rotation = this->display_->get_rotation();
+
+  const uint8_t *src = fb.base;
+  size_t src_stride = fb.stride;
+  if (src == nullptr) {
+    this->shm_stage_.resize(layout.pixel_bytes());
+    this->backend_->read_rect(fb, 0, 0, fb.width, fb.height, this->shm_stage_.data());
+    src = this->shm_stage_.data();
+    src_stride = layout.stride;
+  }
+
+  this->shm_writer_.publish_if_changed(layout, src, src_stride);
+  this->backend_->end_capture();
+}
+#endif
+
 // ============================================================================
 // BMP generation -- called from loop() on the main task
 // ============================================================================
@@ -297,172 +1306,683 @@ void DisplayCaptureHandler::handle_info_(AsyncWebServerRequest *req) {
 // 24-bit uncompressed BMP (BITMAPINFOHEADER format) in PSRAM.
 //
 // Key details:
-//   - Uses static_cast to access DisplayBuffer::buffer_ (dynamic_cast is
-//     unavailable because ESP-IDF builds with -fno-rtti)
+//   - Reads the framebuffer through the configured FramebufferBackend, which
+//     reports its layout (stride, pixel format, byte order)
 //   - Handles all four display rotations by applying the inverse of
 //     ESPHome's draw_pixel_at() rotation transform
 //   - RGB565 (2 bytes/pixel) -> 24-bit BGR (3 bytes/pixel, BMP native order)
 //   - BMP rows are stored bottom-to-top, padded to 4-byte boundaries
 //   - Output size for 320x240: 54 + (960 * 240) = 230,454 bytes
+//
+// The BMP is one of several sinks fed by a single framebuffer pass (see
+// run_pipeline_() and frame_sinks.h). Each capture attaches the sinks its
+// request needs, so hashes, statistics and thumbnails cost compute only.
 
-void DisplayCaptureHandler::generate_bmp_() {
-  // Free the previous screenshot buffer. This is deferred from
-  // handle_screenshot_() because the async web server may still be reading
-  // from the buffer when that function returns. By the time the next request
-  // reaches generate_bmp_(), the previous response is guaranteed to have
-  // been fully sent (the semaphore ensures only one request at a time).
-  if (this->bmp_data_ != nullptr) {
-    heap_caps_free(this->bmp_data_);
-    this->bmp_data_ = nullptr;
-    this->bmp_size_ = 0;
-  }
+uint32_t DisplayCaptureHandler::bmp_file_size_() const {
+  return bmp_file_size(this->display_->get_width(), this->display_->get_height());
+}
 
-  // get_width()/get_height() return dimensions after rotation (what you see on screen).
-  // get_native_width()/get_native_height() return the panel's physical dimensions
-  // (before rotation) -- these are needed for buffer indexing.
+bool DisplayCaptureHandler::generate_bmp_() {
+  const CaptureRequest &request = this->active_request_;
   int screen_w = this->display_->get_width();
   int screen_h = this->display_->get_height();
-  int w_int = this->display_->get_native_width();
-  int h_int = this->display_->get_native_height();
-  auto rotation = this->display_->get_rotation();
+  int src_w = request.region_w > 0 ? request.region_w : screen_w;
+  int src_h = request.region_w > 0 ? request.region_h : screen_h;
+  int out_w = DownscaleSink::output_dimension(src_w, request.scale);
+  int out_h = DownscaleSink::output_dimension(src_h, request.scale);
+  // Only full-screen 24-bit BMPs can have tiles cut from them.
+  bool tiles = request.scale == 1 && request.format == FORMAT_BMP && request.region_w == 0;
 
-  // BMP row stride must be a multiple of 4 bytes
-  int row_stride = ((screen_w * 3 + 3) / 4) * 4;
-  uint32_t pixel_data_size = row_stride * screen_h;
-  uint32_t file_size = 54 + pixel_data_size;  // 14 (file header) + 40 (DIB header) + pixels
+  // Sinks that measure the frame, needed whether or not it gets encoded. Tile
+  // hashes are cheap next to the framebuffer read, so every capture that can
+  // serve tiles leaves them ready for /screenshot/tile. ?format=auto learns
+  // from the colour statistics.
+  HashSink hasher;
+  HistogramSink histogram;
+  RegionWatchSink watch(request.watch_x, request.watch_y, request.watch_w, request.watch_h);
+  std::vector<FrameSink *> sinks;
+  if (tiles)
+    hasher.set_tile_size(this->tile_size_);
+  sinks.push_back(&hasher);
+  if (request.stats || request.format == FORMAT_AUTO)
+    sinks.push_back(&histogram);
+  if (request.watch_w > 0)
+    sinks.push_back(&watch);
 
-  // Allocate in PSRAM (external SPI RAM) -- ~225 KB for 320x240.
-  // Internal SRAM is only ~320 KB total and mostly used by the framework.
-  this->bmp_data_ = (uint8_t *) heap_caps_malloc(file_size, MALLOC_CAP_SPIRAM);
-  if (this->bmp_data_ == nullptr) {
-    ESP_LOGE(TAG, "Failed to allocate %u bytes in PSRAM for BMP", file_size);
-    this->bmp_size_ = 0;
-    return;
+  CapturedFrame frame;
+  frame.request = request;
+  int page = request.page >= 0 ? request.page : this->get_current_page_();
+
+  // Response cache: when a hit is likely, find out with a pass that only
+  // hashes -- no encoder, no PSRAM writes -- and send the cached bytes. A
+  // miss then reads the framebuffer once more to encode. Otherwise the hash
+  // comes with the encoding pass, and a hit there only wastes the encode.
+  int cached = -1;
+  if (this->cache_hit_likely_(page, request)) {
+    if (!this->run_pipeline_(sinks))
+      return false;
+    cached = this->find_cached_(hasher.get_hash(), request);
   }
-  this->bmp_size_ = file_size;
-
-  memset(this->bmp_data_, 0, 54);
-
-  // --- BMP file header (14 bytes) ---
-  this->bmp_data_[0] = 'B';
-  this->bmp_data_[1] = 'M';
-  write_le32_(this->bmp_data_ + 2, file_size);
-  write_le32_(this->bmp_data_ + 10, 54);  // offset to pixel data
-
-  // --- DIB header (BITMAPINFOHEADER, 40 bytes) ---
-  write_le32_(this->bmp_data_ + 14, 40);         // header size
-  write_le32_(this->bmp_data_ + 18, screen_w);   // width
-  write_le32_(this->bmp_data_ + 22, screen_h);   // height (positive = bottom-up)
-  write_le16_(this->bmp_data_ + 26, 1);          // color planes
-  write_le16_(this->bmp_data_ + 28, 24);         // bits per pixel
-  write_le32_(this->bmp_data_ + 34, pixel_data_size);
-
-  // --- Pixel data ---
-  // Get the framebuffer pointer using the configured backend.
-  uint8_t *buf = nullptr;
-  if (this->backend_ == BACKEND_RPI_DPI_RGB) {
-#ifdef USE_RPI_DPI_RGB
-    auto *rgb_display = static_cast<rpi_dpi_rgb::RpiDpiRgb *>(this->display_);
-    if (rgb_display->handle_ == nullptr) {
-      ESP_LOGE(TAG, "rpi_dpi_rgb handle is null");
-      heap_caps_free(this->bmp_data_);
-      this->bmp_data_ = nullptr;
-      this->bmp_size_ = 0;
-      return;
+
+  OutputFormat format = request.format;
+  uint32_t file_size = 0;
+  uint8_t *data = nullptr;
+  if (cached < 0) {
+    if (format == FORMAT_AUTO)
+      format = this->choose_format_(page, out_w * out_h, screen_w * screen_h);
+    data = this->encode_frame_(format, sinks, file_size);
+    if (data == nullptr)
+      return false;
+    if (request.format == FORMAT_AUTO) {
+      this->record_format_stats_(page, format, file_size, out_w * out_h, histogram.get_colors(),
+                                 histogram.get_runs(), screen_w * screen_h);
     }
-    void *fb = nullptr;
-    esp_err_t err = esp_lcd_rgb_panel_get_frame_buffer(rgb_display->handle_, 1, &fb);
-    if (err != ESP_OK || fb == nullptr) {
-      ESP_LOGE(TAG, "Failed to get rpi_dpi_rgb frame buffer (%d)", err);
-      heap_caps_free(this->bmp_data_);
-      this->bmp_data_ = nullptr;
-      this->bmp_size_ = 0;
-      return;
+    cached = this->find_cached_(hasher.get_hash(), request);
+    if (cached >= 0) {
+      heap_caps_free(data);  // never published, so nothing can be sending it
+      data = nullptr;
     }
-    buf = static_cast<uint8_t *>(fb);
-#else
-    ESP_LOGE(TAG, "rpi_dpi_rgb backend requested but USE_RPI_DPI_RGB is not enabled in this build");
-    heap_caps_free(this->bmp_data_);
-    this->bmp_data_ = nullptr;
-    this->bmp_size_ = 0;
+  }
+  if (this->cache_budget_ > 0) {
+    CacheHint &hint = this->cache_hints_[page];
+    hint.repeated = cached >= 0 || hint.content_hash == hasher.get_hash();
+    hint.content_hash = hasher.get_hash();
+  }
+
+  if (cached >= 0) {
+    const CapturedFrame &entry = this->cache_[cached];
+    frame.data = entry.data;
+    frame.size = entry.size;
+    frame.hash = entry.hash;
+    frame.content_hash = entry.content_hash;
+    frame.encoded_format = entry.encoded_format;
+    frame.captured_ms = millis();
+    frame.colors = histogram.get_colors();
+    frame.runs = histogram.get_runs();
+    frame.watch_hash = watch.get_hash();
+    this->cache_hits_++;
+    this->publish_frame_(frame, tiles ? &hasher.get_tile_hashes() : nullptr);
+    ESP_LOGI(TAG, "Served %dx%d BMP from cache (%u bytes)", out_w, out_h, (unsigned) frame.size);
+    return true;
+  }
+  if (this->cache_budget_ > 0)
+    this->cache_misses_++;
+
+  frame.data = data;
+  frame.size = file_size;
+  frame.encoded_format = format;
+  frame.content_hash = hasher.get_hash();
+  // The ETag covers both the frame content and how it was encoded.
+  frame.hash = fnv1a_32_u32(request.scale, frame.content_hash);
+  frame.hash = fnv1a_32_u32(format, frame.hash);
+  frame.hash = fnv1a_32_u32(request.region_x, fnv1a_32_u32(request.region_y, frame.hash));
+  frame.hash = fnv1a_32_u32(request.region_w, fnv1a_32_u32(request.region_h, frame.hash));
+  frame.captured_ms = millis();
+  frame.colors = histogram.get_colors();
+  frame.runs = histogram.get_runs();
+  frame.watch_hash = watch.get_hash();
+  this->publish_frame_(frame, tiles ? &hasher.get_tile_hashes() : nullptr);
+
+  ESP_LOGI(TAG, "Generated %dx%d %s (%u bytes)", out_w, out_h, format_name(format), (unsigned) file_size);
+  return true;
+}
+
+uint8_t *DisplayCaptureHandler::encode_frame_(OutputFormat &format, std::vector<FrameSink *> sinks,
+                                              uint32_t &size) {
+  const CaptureRequest &request = this->active_request_;
+  int src_w = request.region_w > 0 ? request.region_w : this->display_->get_width();
+  int src_h = request.region_w > 0 ? request.region_h : this->display_->get_height();
+  int out_w = DownscaleSink::output_dimension(src_w, request.scale);
+  int out_h = DownscaleSink::output_dimension(src_h, request.scale);
+  uint32_t alloc_size = bmp_file_size(out_w, out_h);
+  if (format == FORMAT_BMP16)
+    alloc_size = bmp16_file_size(out_w, out_h);
+  else if (format == FORMAT_RLE8)
+    alloc_size = Rle8EncoderSink::max_file_size(out_w, out_h);
+
+  // Allocate in PSRAM (external SPI RAM) -- ~225 KB for a 24-bit 320x240.
+  // Internal SRAM is only ~320 KB total and mostly used by the framework.
+  // The previous frame stays servable (as a stale response) until this one is done.
+  auto *data = (uint8_t *) heap_caps_malloc(alloc_size, MALLOC_CAP_SPIRAM);
+  if (data == nullptr) {
+    ESP_LOGE(TAG, "Failed to allocate %u bytes in PSRAM for BMP", alloc_size);
+    return nullptr;
+  }
+
+  // The encoder, behind a downscaler and/or crop when the request asks for them.
+  BmpEncoderSink bmp(data);
+  Bmp16EncoderSink bmp16(data);
+  Rle8EncoderSink rle8(data);
+  FrameSink *output = &bmp;
+  if (format == FORMAT_BMP16)
+    output = &bmp16;
+  else if (format == FORMAT_RLE8)
+    output = &rle8;
+  DownscaleSink thumbnail(output, request.scale);
+  if (request.scale > 1)
+    output = &thumbnail;
+  CropSink crop(output, request.region_x, request.region_y, request.region_w, request.region_h);
+  if (request.region_w > 0)
+    output = &crop;
+  sinks.insert(sinks.begin(), output);
+
+  if (!this->run_pipeline_(sinks)) {
+    heap_caps_free(data);
+    return nullptr;
+  }
+
+  if (format != FORMAT_RLE8) {
+    size = alloc_size;
+    return data;
+  }
+  if (rle8.overflowed()) {
+    heap_caps_free(data);
+    ESP_LOGD(TAG, "More than 256 colours on screen; encoding as bmp16 instead of rle8");
+    format = FORMAT_BMP16;
+    sinks.erase(sinks.begin());
+    return this->encode_frame_(format, sinks, size);
+  }
+  // Give back the worst-case allowance; typical RLE8 frames use a fraction of it.
+  size = rle8.get_size();
+  auto *shrunk = (uint8_t *) heap_caps_realloc(data, size, MALLOC_CAP_SPIRAM);
+  return shrunk != nullptr ? shrunk : data;
+}
+
+void DisplayCaptureHandler::publish_frame_(const CapturedFrame &frame,
+                                           std::vector<std::vector<uint32_t>> *tile_hashes) {
+  // The HTTP task sees either the old frame or the new one, each with its own
+  // tile hashes.
+  xSemaphoreTake(this->frame_lock_, portMAX_DELAY);
+  this->free_retired_frames_();
+  if (this->cache_budget_ > 0)
+    this->cache_insert_(frame);
+  uint8_t *old = this->frame_.data;
+  this->frame_ = frame;
+  this->retire_frame_data_(old);
+  this->tiles_valid_ = tile_hashes != nullptr;
+  if (this->tiles_valid_)
+    this->tile_hashes_ = std::move(*tile_hashes);
+  xSemaphoreGive(this->frame_lock_);
+}
+
+void DisplayCaptureHandler::retire_frame_data_(uint8_t *data) {
+  if (data == nullptr || data == this->frame_.data)
     return;
+  for (const auto &entry : this->cache_) {
+    if (entry.data == data)
+      return;
+  }
+  this->retired_frames_.push_back(data);
+}
+
+void DisplayCaptureHandler::free_retired_frames_() {
+  // Buffers retired by an earlier capture have had a whole capture's time to
+  // finish sending (the deferred free the async server needs). The one the
+  // HTTP task is inside send() with waits for the next capture.
+  auto keep = std::remove_if(this->retired_frames_.begin(), this->retired_frames_.end(), [this](uint8_t *old) {
+    if (old == this->frame_in_flight_)
+      return false;
+    heap_caps_free(old);
+    return true;
+  });
+  this->retired_frames_.erase(keep, this->retired_frames_.end());
+}
+
+// ============================================================================
+// Response cache -- encoded BMPs reused while the screen is unchanged
+// ============================================================================
+//
+// Keyed by the content hash of the whole screen plus the output shape
+// (format, scale, region), so a changed screen simply stops matching and its
+// entries age out. Entries are kept least recently used first and evicted
+// from the front to stay within cache_size. Each entry's buffer may also be
+// frame_.data; retire_frame_data_() frees a buffer only when neither holds it.
+//
+// Checking the cache before encoding costs a second framebuffer read on a
+// miss, so that pass only runs when a hit is likely: the page's last capture
+// hit, or showed the same screen as the one before it, and an entry of this
+// shape exists. A screen that changes on every poll is read once per capture.
+
+bool DisplayCaptureHandler::cache_hit_likely_(int page, const CaptureRequest &request) const {
+  auto hint = this->cache_hints_.find(page);
+  if (hint == this->cache_hints_.end() || !hint->second.repeated)
+    return false;
+  for (const auto &entry : this->cache_) {
+    if (same_output_shape(entry.request, request))
+      return true;
+  }
+  return false;
+}
+
+int DisplayCaptureHandler::find_cached_(uint32_t content_hash, const CaptureRequest &request) const {
+  for (size_t i = 0; i < this->cache_.size(); i++) {
+    if (this->cache_[i].content_hash == content_hash && same_output_shape(this->cache_[i].request, request))
+      return i;
+  }
+  return -1;
+}
+
+void DisplayCaptureHandler::cache_insert_(const CapturedFrame &frame) {
+  int index = this->find_cached_(frame.content_hash, frame.request);
+  if (index >= 0) {
+    // A hit: move it to the back, as the most recently used.
+    std::rotate(this->cache_.begin() + index, this->cache_.begin() + index + 1, this->cache_.end());
+    return;
+  }
+  if (frame.size > this->cache_budget_)
+    return;
+  while (this->cache_bytes_ + frame.size > this->cache_budget_) {
+    uint8_t *evicted = this->cache_.front().data;
+    this->cache_bytes_ -= this->cache_.front().size;
+    this->cache_.erase(this->cache_.begin());
+    this->retire_frame_data_(evicted);
+  }
+  this->cache_.push_back(frame);
+  this->cache_bytes_ += frame.size;
+}
+
+// ============================================================================
+// Automatic format selection -- ?format=auto
+// ============================================================================
+//
+// Pages differ: a text dashboard with a dozen colours is a fraction of its
+// bmp16 size as RLE8, while a photo or gradient has too many colours for a
+// palette. Every auto capture records, for its page, the capture pass time
+// and encoded size of the format it used, smoothed over recent captures, plus
+// the colour count and runs HistogramSink measured in the same pass. The pass
+// reads the whole screen whatever the scale or region, so its time is kept
+// per screen pixel; the size depends on the output, so per output pixel.
+//
+// choose_format_() first tries each eligible format once -- bmp16 first, as
+// it always works and yields the colour count; rle8 only while the page has at
+// most 256 colours -- then picks the lowest cost under auto_policy:
+//
+//   smallest   bytes per output pixel
+//   fastest    capture time per screen pixel
+//   balanced   capture time + transfer time at link_speed, for the
+//              request's screen and output size
+//
+// Every AUTO_REEXPLORE_INTERVAL captures the format measured longest ago is
+// tried again, and a page whose runs per pixel double or halve (its content
+// changed character) starts over, so each page keeps converging on its best
+// format without tuning.
+
+static const uint32_t AUTO_REEXPLORE_INTERVAL = 16;
+
+/// Order in which auto tries formats, and prefers them on equal cost.
+static const OutputFormat AUTO_FORMAT_ORDER[] = {FORMAT_BMP16, FORMAT_RLE8, FORMAT_BMP};
+
+int DisplayCaptureHandler::get_current_page_() const {
+  switch (this->page_mode_) {
+    case NATIVE_PAGES: {
+      const display::DisplayPage *active = this->display_->get_active_page();
+      for (size_t i = 0; i < this->pages_.size(); i++) {
+        if (this->pages_[i] == active)
+          return i;
+      }
+      return -1;
+    }
+#ifdef DISPLAY_CAPTURE_USE_GLOBALS
+    case GLOBAL_PAGES:
+      return this->page_global_->value();
 #endif
+    default:
+      return 0;
+  }
+}
+
+OutputFormat DisplayCaptureHandler::choose_format_(int page, uint32_t pixels, uint32_t screen_pixels) {
+  xSemaphoreTake(this->frame_lock_, portMAX_DELAY);
+  PageFormatStats &stats = this->format_stats_[page];
+  stats.captures++;
+  bool palette_fits = stats.colors > 0 && stats.colors <= 256;
+
+  OutputFormat choice = FORMAT_BMP16;
+  bool exploring = false;
+  // Measure every eligible format once...
+  for (OutputFormat format : AUTO_FORMAT_ORDER) {
+    if ((format != FORMAT_RLE8 || palette_fits) && stats.formats[format].samples == 0) {
+      choice = format;
+      exploring = true;
+      break;
+    }
+  }
+  // ...and now and then re-measure the stalest one.
+  if (!exploring && stats.captures % AUTO_REEXPLORE_INTERVAL == 0) {
+    uint32_t oldest = UINT32_MAX;
+    for (OutputFormat format : AUTO_FORMAT_ORDER) {
+      if ((format != FORMAT_RLE8 || palette_fits) && stats.formats[format].last_capture < oldest) {
+        oldest = stats.formats[format].last_capture;
+        choice = format;
+      }
+    }
+    exploring = true;
+  }
+  if (!exploring) {
+    float best = 0;
+    bool found = false;
+    for (OutputFormat format : AUTO_FORMAT_ORDER) {
+      if (format == FORMAT_RLE8 && !palette_fits)
+        continue;
+      const FormatStats &measured = stats.formats[format];
+      float cost;
+      switch (this->auto_policy_) {
+        case AUTO_SMALLEST:
+          cost = measured.bytes_per_pixel;
+          break;
+        case AUTO_FASTEST:
+          cost = measured.us_per_pixel;
+          break;
+        default:
+          // Bytes at link_speed KB/s take bytes / link_speed ms.
+          cost = measured.us_per_pixel * screen_pixels +
+                 measured.bytes_per_pixel * pixels * 1000.0f / this->link_speed_kbps_;
+          break;
+      }
+      if (!found || cost < best) {
+        best = cost;
+        choice = format;
+        found = true;
+      }
+    }
+  }
+
+  stats.last_choice = choice;
+  xSemaphoreGive(this->frame_lock_);
+  return choice;
+}
+
+void DisplayCaptureHandler::record_format_stats_(int page, OutputFormat format, uint32_t size, uint32_t pixels,
+                                                 uint32_t colors, uint32_t runs, uint32_t screen_pixels) {
+  xSemaphoreTake(this->frame_lock_, portMAX_DELAY);
+  PageFormatStats &stats = this->format_stats_[page];
+  float runs_per_pixel = (float) runs / screen_pixels;
+  if (stats.runs_per_pixel > 0 &&
+      (runs_per_pixel > stats.runs_per_pixel * 2 || runs_per_pixel * 2 < stats.runs_per_pixel)) {
+    ESP_LOGD(TAG, "Page %d content changed character; re-measuring formats", page);
+    for (auto &measured : stats.formats)
+      measured = FormatStats();
+  }
+  stats.colors = colors;
+  stats.runs_per_pixel = runs_per_pixel;
+
+  // Smoothed over ~4 captures, so a page that changes is followed quickly.
+  FormatStats &measured = stats.formats[format];
+  float us = (float) this->last_capture_us_ / screen_pixels;
+  float bytes = (float) size / pixels;
+  if (measured.samples == 0) {
+    measured.us_per_pixel = us;
+    measured.bytes_per_pixel = bytes;
   } else {
-    // Standard DisplayBuffer path (ILI9XXX, ST7789V, etc.)
-    // dynamic_cast is unavailable with -fno-rtti, so we use static_cast.
-    auto *display_buffer = static_cast<display::DisplayBuffer *>(this->display_);
-    buf = display_buffer->buffer_;
-  }
-
-  for (int sy = 0; sy < screen_h; sy++) {
-    // BMP stores rows bottom-to-top
-    int bmp_row = screen_h - 1 - sy;
-    uint8_t *row_ptr = this->bmp_data_ + 54 + bmp_row * row_stride;
-
-    for (int sx = 0; sx < screen_w; sx++) {
-      // Map screen coordinates (sx, sy) to buffer coordinates (bx, by).
-      //
-      // ESPHome's draw_pixel_at() applies a forward rotation transform when
-      // writing pixels to the buffer. We need the INVERSE transform to read
-      // them back in screen order:
-      //
-      //   Rotation | Forward (screen->buffer)       | Inverse (buffer->screen)
-      //   ---------|--------------------------------|-------------------------
-      //   0°       | bx=sx, by=sy                   | bx=sx, by=sy
-      //   90°      | bx=w-1-y, by=x                 | bx=w-1-sy, by=sx
-      //   180°     | bx=w-1-x, by=h-1-y             | bx=w-1-sx, by=h-1-sy
-      //   270°     | bx=y, by=h-1-x                 | bx=sy, by=h-1-sx
-      //
-      // w and h here are native (pre-rotation) panel dimensions.
-      int bx, by;
+    measured.us_per_pixel += (us - measured.us_per_pixel) / 4;
+    measured.bytes_per_pixel += (bytes - measured.bytes_per_pixel) / 4;
+  }
+  measured.samples++;
+  measured.last_capture = stats.captures;
+  xSemaphoreGive(this->frame_lock_);
+}
+
+bool DisplayCaptureHandler::write_bmp_(uint8_t *out) {
+  BmpEncoderSink encoder(out);
+  return this->run_pipeline_({&encoder});
+}
+
+uint32_t DisplayCaptureHandler::get_capture_throughput_kbps() const {
+  if (this->last_capture_us_ == 0)
+    return 0;
+  // bytes/us == MB/s; scale to KB/s (1000-based, like the log line)
+  return (uint32_t) ((uint64_t) this->last_capture_bytes_ * 1000 / this->last_capture_us_);
+}
+
+// ============================================================================
+// Capture pipeline -- one framebuffer pass, fanned out to the sinks
+// ============================================================================
+//
+// The screen is processed in strips of rows. Each strip is converted to BGR
+// into an internal-SRAM strip buffer and handed to every sink: encoders copy
+// it into their PSRAM output, hashers and statistics only read it. Direct
+// mode converts straight from the framebuffer in DIRECT_STRIP_ROWS strips.
+//
+// Throttled mode exists for rpi_dpi_rgb panels, where the LCD peripheral DMAs
+// the framebuffer out of PSRAM continuously and a tight full-frame read loop
+// starves that DMA so the panel visibly shifts. It instead:
+//
+//   1. Copies the framebuffer rectangle needed for burst_rows screen rows into
+//      an internal-SRAM staging buffer (short sequential PSRAM bursts)
+//   2. Converts from SRAM into the SRAM strip (no PSRAM traffic)
+//   3. Feeds the strip to the sinks
+//   4. Sleeps burst_gap so the LCD DMA can catch up
+//
+// The sleeps stay inside this loop() pass: the display is in its capture
+// state until the pass ends, so the capture can't be split across passes the
+// way a sweep is. A throttled capture blocks loop() for about
+// (rows / burst_rows - 1) * burst_gap on top of the conversion -- ~120 ms on a
+// 480-row panel with the defaults, which ESPHome reports as a long loop().
+//
+// Under rotation, a strip of screen rows is a strip of buffer columns; the
+// gather in step 1 then copies burst_rows pixels from every buffer row.
+//
+// The pixel kernel is specialized per backend descriptor: convert_run<ORDER>()
+// is instantiated for each byte order, and rotation is reduced to a start
+// pointer and a step per screen row, so the inner loop has no branches.
+
+/// Strip height in direct mode -- 15 KB of SRAM for a 320-pixel-wide screen.
+static const int DIRECT_STRIP_ROWS = 16;
+
+/// Converts `count` RGB565 pixels, `step` bytes apart starting at `src`, to BGR888.
+template<ByteOrder ORDER> static void convert_run(const uint8_t *src, ptrdiff_t step, int count, uint8_t *dst) {
+  for (int i = 0; i < count; i++, src += step, dst += 3) {
+    // Decode RGB565 pixel (2 bytes per pixel):
+    //
+    //   high byte = RRRRRGGG  (5 bits red, upper 3 bits green)
+    //   low byte  = GGGBBBBB  (lower 3 bits green, 5 bits blue)
+    //
+    // The backend's byte order says which of the two comes first in memory.
+    uint8_t high = ORDER == BYTE_ORDER_BIG_ENDIAN ? src[0] : src[1];
+    uint8_t low = ORDER == BYTE_ORDER_BIG_ENDIAN ? src[1] : src[0];
+
+    uint8_t r5 = high >> 3;
+    uint8_t g6 = ((high & 0x07) << 3) | (low >> 5);
+    uint8_t b5 = low & 0x1F;
+
+    // Expand to 8-bit per channel with proper scaling (not just shifting).
+    // BMP pixel order is BGR (not RGB).
+    dst[0] = (b5 * 255) / 31;
+    dst[1] = (g6 * 255) / 63;
+    dst[2] = (r5 * 255) / 31;
+  }
+}
+
+bool DisplayCaptureHandler::run_pipeline_(const std::vector<FrameSink *> &sinks) {
+  if (this->backend_ == nullptr) {
+    ESP_LOGE(TAG, "No framebuffer backend configured");
+    return false;
+  }
+  FramebufferInfo fb;
+  if (!this->backend_->begin_capture(fb))
+    return false;
+  bool ok = this->feed_sinks_(fb, sinks);
+  this->backend_->end_capture();
+  return ok;
+}
+
+bool DisplayCaptureHandler::feed_sinks_(const FramebufferInfo &fb, const std::vector<FrameSink *> &sinks) {
+  // get_width()/get_height() return dimensions after rotation (what you see on screen).
+  // The backend reports the panel's native dimensions (before rotation) --
+  // these are needed for buffer indexing.
+  int screen_w = this->display_->get_width();
+  int screen_h = this->display_->get_height();
+  int w_int = fb.width;
+  int h_int = fb.height;
+  auto rotation = this->display_->get_rotation();
+  bool throttled = this->read_mode_ == READ_THROTTLED;
+  // Backends without a readable base pointer are always read through read_rect().
+  bool gather = throttled || fb.base == nullptr;
+  int row_stride = bmp_row_stride(screen_w);
+
+  if (fb.format != PIXEL_FORMAT_RGB565) {
+    ESP_LOGE(TAG, "Unsupported pixel format from %s backend", this->backend_->get_name());
+    return false;
+  }
+
+  // Allocate staging in internal SRAM, halving the strip until it fits.
+  int wanted = std::max(1, std::min<int>(throttled ? this->burst_rows_ : DIRECT_STRIP_ROWS, screen_h));
+  int rows = wanted;
+  uint8_t *stage_in = nullptr;
+  uint8_t *stage_out = nullptr;
+  while (true) {
+    if (gather)
+      stage_in = (uint8_t *) heap_caps_malloc(rows * screen_w * 2, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    stage_out = (uint8_t *) heap_caps_malloc(rows * row_stride, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    if ((stage_in != nullptr || !gather) && stage_out != nullptr)
+      break;
+    heap_caps_free(stage_in);
+    heap_caps_free(stage_out);
+    stage_in = nullptr;
+    if (rows == 1) {
+      ESP_LOGE(TAG, "Failed to allocate internal SRAM staging for capture");
+      return false;
+    }
+    rows /= 2;
+  }
+  if (rows < wanted)
+    ESP_LOGW(TAG, "Capture: reduced strip to %d rows (internal SRAM)", rows);
+
+  bool ok = true;
+  for (auto *sink : sinks)
+    ok = ok && sink->begin(screen_w, screen_h);
+
+  uint32_t start_us = micros();
+  for (int sy0 = 0; ok && sy0 < screen_h; sy0 += rows) {
+    int sy1 = std::min(sy0 + rows, screen_h);
+    int n = sy1 - sy0;
+
+    if (!gather) {
+      this->convert_rows_(fb, fb.base, 0, 0, fb.stride, sy0, sy1, stage_out, row_stride);
+    } else {
+      // Buffer rectangle covering screen rows [sy0, sy1) -- inverse of the
+      // rotation table in convert_rows_().
+      int x0 = 0, y0 = 0, rw = w_int, rh = h_int;
       switch (rotation) {
-        case display::DISPLAY_ROTATION_0_DEGREES:
-          bx = sx;
-          by = sy;
-          break;
         case display::DISPLAY_ROTATION_90_DEGREES:
-          bx = w_int - 1 - sy;
-          by = sx;
+          x0 = w_int - sy1;
+          rw = n;
           break;
         case display::DISPLAY_ROTATION_180_DEGREES:
-          bx = w_int - 1 - sx;
-          by = h_int - 1 - sy;
+          y0 = h_int - sy1;
+          rh = n;
           break;
         case display::DISPLAY_ROTATION_270_DEGREES:
-          bx = sy;
-          by = h_int - 1 - sx;
+          x0 = sy0;
+          rw = n;
           break;
         default:
-          bx = sx;
-          by = sy;
+          y0 = sy0;
+          rh = n;
           break;
       }
 
-      // Decode RGB565 pixel (2 bytes per pixel in BITS_16 mode):
-      //
-      //   byte[0] = RRRRRGGG  (high byte: 5 bits red, upper 3 bits green)
-      //   byte[1] = GGGBBBBB  (low byte: lower 3 bits green, 5 bits blue)
-      //
-      // Expand to 8-bit per channel with proper scaling (not just shifting).
-      uint32_t pos = (by * w_int + bx) * 2;
-      uint8_t high = buf[pos];
-      uint8_t low = buf[pos + 1];
+      // Step 1: gather through the backend, then step 2: convert in SRAM.
+      this->backend_->read_rect(fb, x0, y0, rw, rh, stage_in);
+      this->convert_rows_(fb, stage_in, x0, y0, (size_t) rw * 2, sy0, sy1, stage_out, row_stride);
+    }
 
-      uint8_t r5 = high >> 3;
-      uint8_t g6 = ((high & 0x07) << 3) | (low >> 5);
-      uint8_t b5 = low & 0x1F;
-      uint8_t r = (r5 * 255) / 31;
-      uint8_t g = (g6 * 255) / 63;
-      uint8_t b = (b5 * 255) / 31;
+    // Step 3: fan out.
+    for (auto *sink : sinks)
+      sink->strip(sy0, n, stage_out, row_stride);
 
-      // BMP pixel order is BGR (not RGB)
-      row_ptr[sx * 3 + 0] = b;
-      row_ptr[sx * 3 + 1] = g;
-      row_ptr[sx * 3 + 2] = r;
+    // Step 4: yield the bus. Whole milliseconds go through delay() so other
+    // tasks can run; the remainder is a short busy-wait.
+    if (throttled && sy1 < screen_h && this->burst_gap_us_ > 0) {
+      if (this->burst_gap_us_ >= 1000)
+        delay(this->burst_gap_us_ / 1000);
+      if (this->burst_gap_us_ % 1000)
+        delayMicroseconds(this->burst_gap_us_ % 1000);
     }
   }
 
-  ESP_LOGI(TAG, "Generated %dx%d BMP (%u bytes)", screen_w, screen_h, file_size);
+  heap_caps_free(stage_in);
+  heap_caps_free(stage_out);
+  if (!ok)
+    return false;
+  for (auto *sink : sinks)
+    sink->end();
+
+  // Track achieved PSRAM throughput: the framebuffer bytes read plus whatever
+  // the encoders wrote (nothing for a hash-only pass).
+  this->last_capture_us_ = micros() - start_us;
+  size_t written = 0;
+  for (auto *sink : sinks)
+    written += sink->get_written_bytes();
+  this->last_capture_bytes_ = (uint32_t) ((size_t) w_int * h_int * 2 + written);
+  if (throttled) {
+    ESP_LOGD(TAG, "Throttled read: %u bytes in %u us (%u KB/s)", this->last_capture_bytes_, this->last_capture_us_,
+             this->get_capture_throughput_kbps());
+  }
+  return true;
+}
+
+void DisplayCaptureHandler::convert_rows_(const FramebufferInfo &fb, const uint8_t *src, int src_x0, int src_y0,
+                                          size_t src_stride, int sy0, int sy1, uint8_t *dst, int row_stride) {
+  int screen_w = this->display_->get_width();
+  int w_int = fb.width;
+  int h_int = fb.height;
+  auto rotation = this->display_->get_rotation();
+  ptrdiff_t stride = src_stride;
+
+  for (int sy = sy0; sy < sy1; sy++) {
+    uint8_t *row_ptr = dst + (sy - sy0) * row_stride;
+    // Zero the row padding so identical frames produce identical bytes
+    memset(row_ptr + screen_w * 3, 0, row_stride - screen_w * 3);
+
+    // Map screen coordinates (sx, sy) to buffer coordinates (bx, by).
+    //
+    // ESPHome's draw_pixel_at() applies a forward rotation transform when
+    // writing pixels to the buffer. We need the INVERSE transform to read
+    // them back in screen order:
+    //
+    //   Rotation | Forward (screen->buffer)       | Inverse (buffer->screen)
+    //   ---------|--------------------------------|-------------------------
+    //   0°       | bx=sx, by=sy                   | bx=sx, by=sy
+    //   90°      | bx=w-1-y, by=x                 | bx=w-1-sy, by=sx
+    //   180°     | bx=w-1-x, by=h-1-y             | bx=w-1-sx, by=h-1-sy
+    //   270°     | bx=y, by=h-1-x                 | bx=sy, by=h-1-sx
+    //
+    // w and h here are native (pre-rotation) panel dimensions. Along a screen
+    // row only one of bx/by changes, by +-1, so each row is a start pixel
+    // (sx = 0) plus a constant step in bytes.
+    int bx, by;
+    ptrdiff_t step;
+    switch (rotation) {
+      case display::DISPLAY_ROTATION_90_DEGREES:
+        bx = w_int - 1 - sy;
+        by = 0;
+        step = stride;
+        break;
+      case display::DISPLAY_ROTATION_180_DEGREES:
+        bx = w_int - 1;
+        by = h_int - 1 - sy;
+        step = -2;
+        break;
+      case display::DISPLAY_ROTATION_270_DEGREES:
+        bx = sy;
+        by = h_int - 1;
+        step = -stride;
+        break;
+      default:
+        bx = 0;
+        by = sy;
+        step = 2;
+        break;
+    }
+
+    const uint8_t *start = src + (by - src_y0) * stride + (bx - src_x0) * 2;
+    if (fb.byte_order == BYTE_ORDER_BIG_ENDIAN) {
+      convert_run<BYTE_ORDER_BIG_ENDIAN>(start, step, screen_w, row_ptr);
+    } else {
+      convert_run<BYTE_ORDER_LITTLE_ENDIAN>(start, step, screen_w, row_ptr);
+    }
+  }
 }
 
 }  // namespace display_capture
@@ -2,21 +2,32 @@
 //
 // This header declares the DisplayCaptureHandler class using only forward
 // declarations and public APIs. It compiles cleanly alongside all other
-// ESPHome headers. The implementation in display_capture.cpp uses the
-// #define protected public hack in its own translation unit to access
-// the display buffer.
+// ESPHome headers. Framebuffer access goes through a FramebufferBackend;
+// the backends in framebuffer_backends.cpp use the #define protected public
+// hack in their own translation unit to reach driver internals.
 //
 // See README.md for full documentation.
 
 #pragma once
 
 #include "esphome/components/web_server_base/web_server_base.h"
+#include "esphome/core/automation.h"
 #include "esphome/core/component.h"
+#include "esphome/core/defines.h"
 #include "esphome/core/log.h"
 
+#include "frame_sinks.h"
+#include "framebuffer_backend.h"
+#ifdef USE_HOST
+#include "host_shims.h"
+#include "shm_protocol.h"
+#else
 #include <freertos/FreeRTOS.h>
 #include <freertos/semphr.h>
+#endif
 
+#include <cstring>
+#include <map>
 #include <string>
 #include <vector>
 
@@ -46,22 +57,125 @@ enum PageMode {
   GLOBAL_PAGES,  ///< User-managed globals<int> -- sets/restores the int value
 };
 
-/// Which display backend to use for framebuffer access.
-enum CaptureBackend {
-  BACKEND_DISPLAY_BUFFER,  ///< Standard DisplayBuffer (ILI9XXX, ST7789V, etc.)
-  BACKEND_RPI_DPI_RGB,     ///< rpi_dpi_rgb (ESP32-S3 RGB LCD panels)
+/// How the framebuffer is read during capture.
+enum ReadMode {
+  READ_DIRECT,     ///< Convert straight from the framebuffer in one pass (fastest)
+  READ_THROTTLED,  ///< Burst-copy strips through internal SRAM with gaps (safe on live RGB panels)
+};
+
+/// What the main loop should produce for a pending request.
+enum RequestKind {
+  REQUEST_SCREENSHOT,  ///< One BMP (GET /screenshot)
+  REQUEST_SWEEP,       ///< One BMP per sweep state (GET /screenshot/sweep)
+};
+
+/// Encoding of the image returned by /screenshot.
+enum OutputFormat {
+  FORMAT_BMP,    ///< 24-bit BMP (?format=bmp, the default)
+  FORMAT_BMP16,  ///< 16-bit RGB565 BMP, lossless for RGB565 panels (?format=bmp16)
+  FORMAT_RLE8,   ///< 8-bit palette BMP, RLE-compressed; bmp16 above 256 colours (?format=rle8)
+  FORMAT_AUTO,   ///< Picked per page from measured size and encode time (?format=auto)
+};
+
+/// Number of encoders FORMAT_AUTO chooses between (the formats before it).
+static const int ENCODED_FORMAT_COUNT = FORMAT_AUTO;
+
+/// What ?format=auto optimizes for.
+enum AutoPolicy {
+  AUTO_BALANCED,  ///< Encode time plus transfer time at link_speed
+  AUTO_SMALLEST,  ///< Smallest response
+  AUTO_FASTEST,   ///< Shortest capture
+};
+
+/// One encoder's results on one page, smoothed over recent captures.
+/// Per pixel, so captures with different scale or region compare.
+struct FormatStats {
+  uint32_t samples{0};          ///< Captures measured
+  uint32_t last_capture{0};     ///< PageFormatStats::captures when last measured
+  float us_per_pixel{0};        ///< Capture pass time per screen pixel (every pass reads the whole screen)
+  float bytes_per_pixel{0};     ///< Encoded size per output pixel
+};
+
+/// What automatic format selection knows about one page.
+struct PageFormatStats {
+  FormatStats formats[ENCODED_FORMAT_COUNT];
+  uint32_t captures{0};         ///< ?format=auto captures of this page
+  uint32_t colors{0};           ///< Distinct colours at the last capture (0 = not seen yet)
+  float runs_per_pixel{0};      ///< Horizontal runs per pixel at the last capture
+  OutputFormat last_choice{FORMAT_BMP16};
+};
+
+/// What the response cache saw on a page's last capture, to guess the next one.
+struct CacheHint {
+  uint32_t content_hash{0};  ///< Screen hash of that capture
+  bool repeated{false};      ///< It hit the cache, or showed the same screen as the capture before
+};
+
+/// A pending capture, written by the HTTP task before it sets request_pending_.
+/// The optional fields choose which sinks the capture pipeline attaches.
+struct CaptureRequest {
+  RequestKind kind{REQUEST_SCREENSHOT};
+  int page{-1};        ///< Page to capture (-1 = current)
+  int scale{1};        ///< Downscale factor of the returned BMP (1, 2, 4 or 8)
+  OutputFormat format{FORMAT_BMP};  ///< Encoding of the returned image
+  int region_x{0};     ///< Screen rectangle to return (CropSink), whole screen if region_w == 0
+  int region_y{0};
+  int region_w{0};
+  int region_h{0};
+  bool stats{false};   ///< Collect colour statistics (HistogramSink)
+  int watch_x{0};      ///< Region to hash (RegionWatchSink), ignored if watch_w == 0
+  int watch_y{0};
+  int watch_w{0};
+  int watch_h{0};
+  uint32_t seq{0};           ///< Request number, matched against completed_seq_
+  uint32_t requested_ms{0};  ///< millis() when the HTTP task queued the request
+};
+
+/// A finished single-frame capture: the BMP plus what was measured alongside
+/// it. The HTTP task copies it under frame_lock_; the data pointer stays
+/// valid while the copy is in use (see retire_frame_data_()). Response cache
+/// entries are CapturedFrames too, and may share their data with frame_.
+struct CapturedFrame {
+  uint8_t *data{nullptr};    ///< PSRAM buffer holding the BMP
+  size_t size{0};            ///< Size of the BMP in bytes
+  uint32_t hash{0};          ///< ETag hash (frame content + output format, scale and region)
+  uint32_t content_hash{0};  ///< Hash of the whole screen's pixels (HashSink), the cache key
+  OutputFormat encoded_format{FORMAT_BMP};  ///< Format of data (differs from request.format for auto)
+  uint32_t captured_ms{0};   ///< millis() when the capture finished
+  CaptureRequest request;    ///< Parameters it was captured with
+  uint32_t colors{0};        ///< Distinct colours (if request.stats)
+  uint32_t runs{0};          ///< Horizontal runs (if request.stats)
+  uint32_t watch_hash{0};    ///< Hash of the watched region (if request.watch_w)
+};
+
+/// Multipart boundary used by GET /screenshot/sweep responses.
+static const char *const SWEEP_BOUNDARY = "display_capture_sweep";
+
+/// One dimension of a state sweep: a globals component and the values it
+/// should take. Exactly one of int_global/bool_global is set; bool values
+/// are stored as 0/1.
+struct SweepAxis {
+  std::string name;                                      ///< YAML id, echoed in part headers
+  globals::GlobalsComponent<int> *int_global{nullptr};   ///< Set for globals<int>
+  globals::GlobalsComponent<bool> *bool_global{nullptr}; ///< Set for globals<bool>
+  std::vector<int> values;                               ///< Values to sweep, in order
+  int saved_value{0};                                    ///< Value restored after the sweep
 };
 
 /// HTTP handler that captures the display framebuffer as a BMP image.
 ///
-/// Registers two endpoints on the device's existing web server:
-///   GET /screenshot[?page=N]  -- returns a 24-bit BMP of the display
-///   GET /screenshot/info      -- returns JSON metadata (page count, dimensions, mode)
+/// Registers these endpoints on the device's existing web server:
+///   GET /screenshot[?page=N&format=F&scale=S&region=x,y,w,h&stats=1&watch=x,y,w,h] -- returns a BMP of the display
+///   GET /screenshot/sweep[?page=N]  -- returns one BMP per sweep state (multipart/mixed)
+///   GET /screenshot/tiles[?page=N]  -- captures, returns JSON tile hashes for every zoom level
+///   GET /screenshot/tile/{z}/{x}/{y} -- returns one tile of the last full-scale capture (cacheable)
+///   GET /screenshot/info            -- returns JSON metadata (page count, dimensions, mode)
 ///
 /// Thread safety: the /screenshot endpoint uses a binary semaphore to hand off
 /// rendering work to the main ESPHome loop, since the display buffer can only
-/// be safely accessed from that task. The /info endpoint reads only immutable
-/// setup-time data and runs directly on the HTTP task.
+/// be safely accessed from that task. The /info, /tiles and /tile endpoints run
+/// directly on the HTTP task and read state shared with the main loop (frame,
+/// tile hashes, cache, auto-format statistics) under frame_lock_.
 class DisplayCaptureHandler : public AsyncWebHandler, public Component {
  public:
   DisplayCaptureHandler(web_server_base::WebServerBase *base) : base_(base) {}
@@ -86,12 +200,65 @@ class DisplayCaptureHandler : public AsyncWebHandler, public Component {
 
   void add_page_name(const std::string &name) { this->page_names_.push_back(name); }
 
-  void set_backend(const std::string &backend) {
-    if (backend == "rpi_dpi_rgb") {
-      this->backend_ = BACKEND_RPI_DPI_RGB;
-      return;
-    }
-    this->backend_ = BACKEND_DISPLAY_BUFFER;
+  /// Add a globals<int> sweep dimension. Overloads are picked at compile time
+  /// from the global's declared type.
+  void add_sweep_global(globals::GlobalsComponent<int> *global, const std::string &name,
+                        const std::vector<int> &values) {
+    SweepAxis axis;
+    axis.name = name;
+    axis.int_global = global;
+    axis.values = values;
+    this->sweep_axes_.push_back(axis);
+  }
+
+  /// Add a globals<bool> sweep dimension (values are 0/1).
+  void add_sweep_global(globals::GlobalsComponent<bool> *global, const std::string &name,
+                        const std::vector<int> &values) {
+    SweepAxis axis;
+    axis.name = name;
+    axis.bool_global = global;
+    axis.values = values;
+    this->sweep_axes_.push_back(axis);
+  }
+
+  /// Framebuffer access for the configured display (owned by the handler).
+  void set_backend(FramebufferBackend *backend) { this->backend_ = backend; }
+
+  void set_read_mode(const std::string &mode) {
+    this->read_mode_ = mode == "throttled" ? READ_THROTTLED : READ_DIRECT;
+  }
+  /// Screen rows converted per burst in throttled mode.
+  void set_burst_rows(uint16_t rows) { this->burst_rows_ = rows; }
+  /// Pause between bursts in throttled mode.
+  void set_burst_gap(uint32_t gap_us) { this->burst_gap_us_ = gap_us; }
+  /// Edge length of /screenshot/tile tiles, in pixels.
+  void set_tile_size(uint16_t tile_size) { this->tile_size_ = tile_size; }
+  /// Serve the last matching frame (with an Age header) when a fresh capture
+  /// would miss the deadline, instead of waiting or failing.
+  void set_serve_stale(bool serve_stale) { this->serve_stale_ = serve_stale; }
+  /// Longest a /screenshot request waits for a fresh capture when it could serve stale.
+  void set_max_wait(uint32_t max_wait_ms) { this->max_wait_ms_ = max_wait_ms; }
+  /// PSRAM budget of the response cache in bytes (0 = no cache).
+  void set_cache_size(uint32_t cache_size) { this->cache_budget_ = cache_size; }
+  /// Optimization goal of ?format=auto: "balanced", "smallest" or "fastest".
+  void set_auto_policy(const std::string &policy) {
+    this->auto_policy_ = policy == "smallest" ? AUTO_SMALLEST : policy == "fastest" ? AUTO_FASTEST : AUTO_BALANCED;
+  }
+  /// Expected client throughput in KB/s, weighing size against encode time for AUTO_BALANCED.
+  void set_link_speed(uint32_t link_speed_kbps) { this->link_speed_kbps_ = link_speed_kbps; }
+  /// Accept `screenshot [page]` commands on the serial console.
+  void set_serial_console(bool serial_console) { this->serial_console_ = serial_console; }
+#ifdef USE_HOST
+  /// Publish the framebuffer to the POSIX shared-memory segment `name` (see shm_protocol.h).
+  void set_shared_memory(const std::string &name) { this->shm_name_ = name; }
+#endif
+
+  /// Captures `page` (-1 = current) on the next loop() pass and streams it over
+  /// the serial console (see serial_protocol.h). Main loop only -- used by the
+  /// display_capture.serial_capture action and the console command.
+  void request_serial_capture(int page = -1) {
+    this->serial_pending_ = true;
+    this->serial_page_ = page;
   }
 
   // --- AsyncWebHandler interface ---
@@ -99,7 +266,9 @@ class DisplayCaptureHandler : public AsyncWebHandler, public Component {
   bool canHandle(AsyncWebServerRequest *request) const override {
     if (request->method() != HTTP_GET)
       return false;
-    return request->url() == "/screenshot" || request->url() == "/screenshot/info";
+    return request->url() == "/screenshot" || request->url() == "/screenshot/info" ||
+           request->url() == "/screenshot/sweep" || request->url() == "/screenshot/tiles" ||
+           strncmp(request->url().c_str(), "/screenshot/tile/", 17) == 0;
   }
 
   void handleRequest(AsyncWebServerRequest *req) override {
@@ -107,6 +276,18 @@ class DisplayCaptureHandler : public AsyncWebHandler, public Component {
       this->handle_info_(req);
       return;
     }
+    if (req->url() == "/screenshot/sweep") {
+      this->handle_sweep_(req);
+      return;
+    }
+    if (req->url() == "/screenshot/tiles") {
+      this->handle_tiles_(req);
+      return;
+    }
+    if (strncmp(req->url().c_str(), "/screenshot/tile/", 17) == 0) {
+      this->handle_tile_(req);
+      return;
+    }
     this->handle_screenshot_(req);
   }
 
@@ -116,31 +297,146 @@ class DisplayCaptureHandler : public AsyncWebHandler, public Component {
   /// Run after WiFi but before other late components.
   float get_setup_priority() const override { return setup_priority::WIFI - 1.0f; }
   void loop() override;
+  /// Restores stdin's flags if setup() made it non-blocking.
+  void on_shutdown() override;
 
   /// Returns the number of known pages (from pages list or page_names).
   int get_page_count() const;
 
+  /// Returns the number of states in a full sweep (product of all value sets).
+  size_t get_sweep_state_count() const;
+
+  /// PSRAM throughput of the last framebuffer conversion (bytes read + written), in KB/s.
+  uint32_t get_capture_throughput_kbps() const;
+
  protected:
   /// Handles GET /screenshot -- sets request_pending_ and blocks on semaphore.
   void handle_screenshot_(AsyncWebServerRequest *req);
+  /// Handles GET /screenshot/sweep -- like handle_screenshot_(), but waits for every state.
+  void handle_sweep_(AsyncWebServerRequest *req);
+  /// Handles GET /screenshot/tiles -- captures via the semaphore, returns tile hashes as JSON.
+  void handle_tiles_(AsyncWebServerRequest *req);
+  /// Handles GET /screenshot/tile/{z}/{x}/{y} -- serves a tile from the last capture, no semaphore
+  /// needed unless there is no single-frame capture to serve from.
+  void handle_tile_(AsyncWebServerRequest *req);
   /// Handles GET /screenshot/info -- returns JSON, no semaphore needed.
   void handle_info_(AsyncWebServerRequest *req);
-  /// Reads the display buffer and generates a 24-bit BMP in PSRAM.
-  void generate_bmp_();
-
-  /// Write a 32-bit value in little-endian byte order (for BMP headers).
-  static void write_le32_(uint8_t *p, uint32_t v) {
-    p[0] = v & 0xFF;
-    p[1] = (v >> 8) & 0xFF;
-    p[2] = (v >> 16) & 0xFF;
-    p[3] = (v >> 24) & 0xFF;
-  }
-
-  /// Write a 16-bit value in little-endian byte order (for BMP headers).
-  static void write_le16_(uint8_t *p, uint16_t v) {
-    p[0] = v & 0xFF;
-    p[1] = (v >> 8) & 0xFF;
-  }
+  /// Hands a request to the main loop and waits for it. Returns false on timeout;
+  /// with `cancel_on_timeout` false the capture still runs for the next caller.
+  /// `seq_out`, if given, receives the request number.
+  bool request_capture_(const CaptureRequest &request, uint32_t timeout_ms, bool cancel_on_timeout = true,
+                        uint32_t *seq_out = nullptr);
+  /// How long a /screenshot request may wait for a fresh frame before serving
+  /// `stale` instead (0 = serve it right away), from the capture time EWMA.
+  uint32_t get_fresh_deadline_ms_(const CapturedFrame *stale) const;
+  /// Copies the current frame under frame_lock_; marks it in flight if `sending`.
+  CapturedFrame snapshot_frame_(bool sending);
+  /// Clears the in-flight mark set by snapshot_frame_().
+  void end_send_();
+  /// Sends `frame` as the /screenshot response (304 if If-None-Match matches).
+  /// A stale frame also gets an Age header.
+  void send_frame_(AsyncWebServerRequest *req, const CapturedFrame &frame, bool stale);
+  /// Adds the ETag and the optional stats/watch headers of a frame.
+  static void add_capture_headers_(AsyncWebServerResponse *response, const CapturedFrame &frame,
+                                   const std::string &etag);
+
+  /// Wakes the display and switches to active_request_.page, remembering what to restore.
+  void enter_capture_state_();
+  /// Restores page and sleep state, re-rendering if anything changed (or if forced).
+  void leave_capture_state_(bool force_update);
+
+  /// Allocates the multipart buffer and saves every sweep global. Returns false on failure.
+  bool begin_sweep_();
+  /// Renders and encodes one sweep state; finishes the sweep after the last one.
+  void sweep_step_();
+  /// Value of sweep axis `axis` in sweep state `state` (last axis varies fastest).
+  int sweep_value_(size_t axis, size_t state) const;
+  /// MIME part headers (boundary line included) for sweep state `state`.
+  std::string sweep_part_header_(size_t state) const;
+  /// Reads / writes a sweep axis' global, whichever type it is.
+  int get_sweep_global_(const SweepAxis &axis) const;
+  void set_sweep_global_(const SweepAxis &axis, int value);
+
+  /// Tile pyramid geometry for the current display dimensions.
+  TileGrid get_tile_grid_() const;
+  /// Writes tile (z, x, y) of the full-resolution BMP `frame` as a BMP into `out`
+  /// (sized by tile_bmp_size_()). Downscaled levels are box-filtered.
+  void write_tile_bmp_(const uint8_t *frame, int z, int x, int y, uint8_t *out) const;
+  /// BMP size of tile (z, x, y) -- edge tiles are clipped to the frame.
+  uint32_t tile_bmp_size_(int z, int x, int y) const;
+
+  /// Size in bytes of a BMP for the current display dimensions.
+  uint32_t bmp_file_size_() const;
+  /// Writes a complete BMP (headers + pixels) for the current framebuffer into `out`,
+  /// which must hold bmp_file_size_() bytes. Returns false if the framebuffer is unavailable.
+  bool write_bmp_(uint8_t *out);
+  /// Runs the capture pipeline for active_request_: generates the BMP in PSRAM and
+  /// collects whatever else the request asked for, in one framebuffer pass -- or,
+  /// when the response cache may hold it, hashes first and reuses the cached BMP.
+  /// The result replaces frame_ only on success. Returns false on failure.
+  bool generate_bmp_();
+  /// Encodes one framebuffer pass of active_request_ as `format` into a new PSRAM
+  /// buffer, feeding the measuring `sinks` alongside. An RLE8 frame with too many
+  /// colours is encoded again as BMP16, updating `format`. Returns nullptr on failure.
+  uint8_t *encode_frame_(OutputFormat &format, std::vector<FrameSink *> sinks, uint32_t &size);
+  /// Index of the page on screen (-1 if unknown), for per-page statistics.
+  int get_current_page_() const;
+  /// The format ?format=auto should use for `page` next, for an output of
+  /// `pixels` from a screen of `screen_pixels` (see "Automatic format selection").
+  OutputFormat choose_format_(int page, uint32_t pixels, uint32_t screen_pixels);
+  /// Folds one auto capture into the page's statistics.
+  void record_format_stats_(int page, OutputFormat format, uint32_t size, uint32_t pixels, uint32_t colors,
+                            uint32_t runs, uint32_t screen_pixels);
+  /// Makes `frame` the current frame_ (and its tile hashes current, if given).
+  void publish_frame_(const CapturedFrame &frame, std::vector<std::vector<uint32_t>> *tile_hashes);
+  /// Whether `request` on `page` will probably hit the cache, worth a hash-only pass first.
+  bool cache_hit_likely_(int page, const CaptureRequest &request) const;
+  /// Index of the cached response for this content and request shape, or -1.
+  int find_cached_(uint32_t content_hash, const CaptureRequest &request) const;
+  /// Adds `frame` to the response cache (or marks its entry most recently used),
+  /// evicting least recently used entries to stay within the budget. Caller holds
+  /// frame_lock_.
+  void cache_insert_(const CapturedFrame &frame);
+  /// Records the outcome of active_request_ and wakes the waiting HTTP task.
+  void complete_request_(bool ok);
+  /// Captures serial_page_ into an RLE565 buffer and starts sending it.
+  void serial_capture_();
+  /// Sends the next packets of the serial frame, for a bounded time per loop() pass.
+  void serial_send_step_();
+  /// Reads console input without blocking and runs complete command lines.
+  void serial_poll_console_();
+  /// Reads up to `len` bytes of console input without blocking: through the
+  /// logger's UART driver when it has one, else from stdin. Returns <= 0 if none.
+  int serial_read_(char *buf, size_t len);
+  /// Writes raw bytes to the console (stdout), blocking until they are queued.
+  void serial_write_(const uint8_t *data, size_t len);
+#ifdef USE_HOST
+  /// Copies the framebuffer into the shared-memory segment if its pixels or layout
+  /// changed. Polls at most twice per display update interval.
+  void shm_publish_();
+#endif
+  /// Queues a frame buffer for freeing one capture later, unless frame_ or a cache
+  /// entry still uses it. Caller holds frame_lock_.
+  void retire_frame_data_(uint8_t *data);
+  /// Frees buffers retired by earlier captures, except one the HTTP task is still
+  /// sending. Caller holds frame_lock_.
+  void free_retired_frames_();
+  /// Reads the framebuffer once through the backend, in strips of rows converted
+  /// to BGR in internal SRAM, and feeds every strip to each sink. Returns false if
+  /// the framebuffer or staging memory is unavailable, or a sink refuses the frame.
+  bool run_pipeline_(const std::vector<FrameSink *> &sinks);
+  /// run_pipeline_() between the backend's begin_capture() and end_capture().
+  bool feed_sinks_(const FramebufferInfo &fb, const std::vector<FrameSink *> &sinks);
+  /// Converts screen rows [sy0, sy1) to BGR. `src` holds the native rectangle whose
+  /// top-left pixel is (src_x0, src_y0), `src_stride` bytes per row, in fb's format.
+  /// Screen row sy is written to dst + (sy - sy0) * row_stride, padding zeroed.
+  void convert_rows_(const FramebufferInfo &fb, const uint8_t *src, int src_x0, int src_y0, size_t src_stride,
+                     int sy0, int sy1, uint8_t *dst, int row_stride);
+
+  /// Returns the value of a request header, or "" if absent.
+  static std::string get_request_header_(AsyncWebServerRequest *req, const char *name);
+  /// Quoted strong ETag for a content hash, e.g. "\"1a2b3c4d\"".
+  static std::string format_etag_(uint32_t hash);
 
   // --- Configuration state (set once during setup, immutable after) ---
 
@@ -150,20 +446,102 @@ class DisplayCaptureHandler : public AsyncWebHandler, public Component {
   globals::GlobalsComponent<bool> *sleep_global_{nullptr};
 
   PageMode page_mode_{SINGLE};
-  CaptureBackend backend_{BACKEND_DISPLAY_BUFFER};  ///< Framebuffer extraction backend
+  FramebufferBackend *backend_{nullptr};            ///< Framebuffer extraction backend
+  ReadMode read_mode_{READ_DIRECT};                 ///< Framebuffer read strategy
+  uint16_t burst_rows_{8};                          ///< Rows per burst (READ_THROTTLED)
+  uint32_t burst_gap_us_{2000};                     ///< Gap between bursts (READ_THROTTLED), blocks loop()
+  uint16_t tile_size_{64};                          ///< Tile edge length in pixels
   std::vector<display::DisplayPage *> pages_;       ///< Native page pointers (NATIVE_PAGES mode)
   std::vector<std::string> page_names_;             ///< Human-readable names for /info endpoint
+  std::vector<SweepAxis> sweep_axes_;               ///< Globals swept by /screenshot/sweep
+  bool serve_stale_{false};                          ///< Stale-while-revalidate for /screenshot
+  uint32_t max_wait_ms_{1000};                      ///< Fresh-capture wait when stale is servable
+  uint32_t cache_budget_{0};                        ///< Response cache size limit in bytes
+  AutoPolicy auto_policy_{AUTO_BALANCED};           ///< Goal of ?format=auto
+  uint32_t link_speed_kbps_{250};                   ///< Client throughput assumed by AUTO_BALANCED
 
   // --- Per-request state (used during screenshot capture) ---
 
   const display::DisplayPage *saved_native_page_{nullptr};  ///< Page to restore after capture
   int saved_global_page_{0};                                ///< Global value to restore after capture
+  bool page_switched_{false};                               ///< Page must be restored after capture
+  bool was_sleeping_{false};                                ///< Sleep global must be restored after capture
 
   SemaphoreHandle_t semaphore_{nullptr};   ///< Coordinates HTTP task <-> main loop handoff
   volatile bool request_pending_{false};   ///< Flag: HTTP task has a pending screenshot request
-  volatile int requested_page_{-1};        ///< Which page to capture (-1 = current)
-  uint8_t *bmp_data_{nullptr};             ///< PSRAM buffer holding the generated BMP
-  size_t bmp_size_{0};                     ///< Size of the BMP data in bytes
+  CaptureRequest request_;                 ///< What the pending request wants (HTTP task writes)
+  CaptureRequest active_request_;          ///< Copy of request_ being captured (main loop)
+  uint32_t request_seq_{0};                ///< Last request number handed out
+  volatile uint32_t completed_seq_{0};     ///< Request number of the last finished capture (frame_lock_)
+  volatile bool completed_ok_{false};      ///< Whether that capture succeeded (frame_lock_)
+  uint32_t capture_ms_ewma_{0};            ///< Smoothed request-to-frame time (0 = no data yet)
+  uint32_t last_capture_us_{0};            ///< Duration of the last framebuffer conversion
+  uint32_t last_capture_bytes_{0};         ///< PSRAM bytes moved by the last conversion
+  uint32_t served_fresh_{0};               ///< /screenshot responses from a fresh capture
+  uint32_t served_stale_{0};               ///< /screenshot responses from the cached frame
+  uint32_t served_timeout_{0};             ///< /screenshot requests that got a 504
+
+  // --- Frame state (swapped under frame_lock_ by the main loop) ---
+
+  SemaphoreHandle_t frame_lock_{nullptr};         ///< Guards request_, frame_, tiles, cache and frame_in_flight_
+  CapturedFrame frame_;                           ///< Most recent single-frame capture
+  const uint8_t *frame_in_flight_{nullptr};       ///< Frame buffer the HTTP task is sending
+  std::vector<uint8_t *> retired_frames_;         ///< Replaced frame buffers awaiting free
+  bool tiles_valid_{false};                       ///< tile_hashes_ match frame_ (a full-scale frame)
+  std::vector<std::vector<uint32_t>> tile_hashes_;  ///< [z][y * cols + x]
+
+  // --- Response cache (main loop; changed under frame_lock_ so /info can read it) ---
+
+  std::vector<CapturedFrame> cache_;       ///< Encoded responses, least recently used first
+  size_t cache_bytes_{0};                  ///< Total size of cache_ entries
+  uint32_t cache_hits_{0};                 ///< Captures answered from the cache
+  uint32_t cache_misses_{0};               ///< Captures encoded while the cache was enabled
+  std::map<int, CacheHint> cache_hints_;   ///< By page index (-1 = unknown page), main loop only
+
+  // --- Automatic format selection (main loop; changed under frame_lock_ so /info can read it) ---
+
+  std::map<int, PageFormatStats> format_stats_;  ///< By page index (-1 = unknown page)
+
+  // --- Sweep state (spans several loop() passes, one state per pass) ---
+
+  bool sweep_active_{false};               ///< A sweep is in progress
+  size_t sweep_state_{0};                  ///< Next state to render
+  size_t sweep_offset_{0};                 ///< Write position in sweep_data_
+  uint8_t *sweep_data_{nullptr};           ///< PSRAM buffer holding the multipart sweep body
+  size_t sweep_size_{0};                   ///< Size of the sweep body in bytes
+  std::string sweep_error_;                ///< Why the last sweep couldn't start (sent with the 500)
+
+  // --- Serial transport state (main loop only) ---
+
+  bool serial_console_{false};             ///< Console command reader enabled
+  int serial_uart_{-1};                    ///< Logger UART read through its driver, or -1 for stdin
+  int stdin_flags_{-1};                    ///< stdin's flags before O_NONBLOCK (-1 = unchanged)
+  std::string serial_line_;                ///< Console input since the last newline
+  bool serial_pending_{false};             ///< A serial capture was requested
+  int serial_page_{-1};                    ///< Page for the requested serial capture
+  uint8_t *serial_data_{nullptr};          ///< PSRAM buffer holding the RLE565 frame being sent
+  uint8_t serial_frame_id_{0};             ///< Id of the last frame sent (wraps)
+  uint32_t serial_start_ms_{0};            ///< When sending of the current frame began
+  SerialFrameTransmitter serial_tx_;       ///< Packetizes serial_data_
+
+#ifdef USE_HOST
+  // --- Shared-memory export (main loop only) ---
+
+  std::string shm_name_;                   ///< Segment name, empty = export off
+  ShmFrameWriter shm_writer_;              ///< Open while exporting
+  std::vector<uint8_t> shm_stage_;         ///< Frame read through read_rect() for backends without a base pointer
+  uint32_t shm_next_poll_ms_{0};           ///< millis() at which the framebuffer is read next
+#endif
+};
+
+/// Action: display_capture.serial_capture -- streams a screenshot over the serial console.
+template<typename... Ts> class SerialCaptureAction : public Action<Ts...>, public Parented<DisplayCaptureHandler> {
+ public:
+  TEMPLATABLE_VALUE(int, page)
+
+  void play(Ts... x) override {
+    this->parent_->request_serial_capture(this->page_.has_value() ? this->page_.value(x...) : -1);
+  }
 };
 
 }  // namespace display_capture
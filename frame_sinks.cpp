@@ -0,0 +1,452 @@
+// display_capture -- frame sink implementations.
+
+#include "frame_sinks.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace esphome {
+namespace display_capture {
+
+/// Writes the 54-byte BMP file + DIB header (BITMAPINFOHEADER) shared by all
+/// the BMP variants. `data_offset` is where the pixel data starts, after any
+/// masks or palette the caller writes.
+static void write_bmp_headers(uint8_t *out, int width, int height, uint16_t bits_per_pixel, uint32_t compression,
+                              uint32_t data_offset, uint32_t data_size, uint32_t colors_used = 0) {
+  memset(out, 0, 54);
+
+  // --- BMP file header (14 bytes) ---
+  out[0] = 'B';
+  out[1] = 'M';
+  write_le32(out + 2, data_offset + data_size);  // file size
+  write_le32(out + 10, data_offset);             // offset to pixel data
+
+  // --- DIB header (BITMAPINFOHEADER, 40 bytes) ---
+  write_le32(out + 14, 40);               // header size
+  write_le32(out + 18, width);            // width
+  write_le32(out + 22, height);           // height (positive = bottom-up)
+  write_le16(out + 26, 1);                // color planes
+  write_le16(out + 28, bits_per_pixel);   // bits per pixel
+  write_le32(out + 30, compression);      // BI_RGB, BI_RLE8 or BI_BITFIELDS
+  write_le32(out + 34, data_size);
+  write_le32(out + 46, colors_used);      // palette entries used (0 = all)
+}
+
+void write_bmp_header(uint8_t *out, int width, int height) {
+  write_bmp_headers(out, width, height, 24, 0, 54, bmp_row_stride(width) * height);
+}
+
+void write_bmp16_header(uint8_t *out, int width, int height) {
+  // BI_BITFIELDS: the RGB565 channel masks follow the DIB header.
+  write_bmp_headers(out, width, height, 16, 3, BMP16_HEADER_SIZE, bmp16_row_stride(width) * height);
+  write_le32(out + 54, 0xF800);   // red mask
+  write_le32(out + 58, 0x07E0);   // green mask
+  write_le32(out + 62, 0x001F);   // blue mask
+}
+
+int TileGrid::max_zoom() const {
+  int longest = std::max(this->width, this->height);
+  int z = 0;
+  while (((longest + (1 << z) - 1) >> z) > this->tile_size)
+    z++;
+  return z;
+}
+
+// ============================================================================
+// BmpEncoderSink
+// ============================================================================
+
+bool BmpEncoderSink::begin(int width, int height) {
+  this->height_ = height;
+  this->size_ = bmp_file_size(width, height);
+  write_bmp_header(this->out_, width, height);
+  return true;
+}
+
+void BmpEncoderSink::strip(int y, int count, const uint8_t *rows, int stride) {
+  // BMP rows are bottom-up: screen row y lands at BMP row height-1-y.
+  uint8_t *pixels = this->out_ + 54;
+  for (int i = 0; i < count; i++)
+    memcpy(pixels + (size_t) (this->height_ - 1 - (y + i)) * stride, rows + (size_t) i * stride, stride);
+}
+
+// ============================================================================
+// Bmp16EncoderSink
+// ============================================================================
+
+bool Bmp16EncoderSink::begin(int width, int height) {
+  this->width_ = width;
+  this->height_ = height;
+  write_bmp16_header(this->out_, width, height);
+  return true;
+}
+
+void Bmp16EncoderSink::strip(int y, int count, const uint8_t *rows, int stride) {
+  int out_stride = bmp16_row_stride(this->width_);
+  for (int i = 0; i < count; i++) {
+    const uint8_t *px = rows + (size_t) i * stride;
+    uint8_t *out = this->out_ + BMP16_HEADER_SIZE + (size_t) (this->height_ - 1 - (y + i)) * out_stride;
+    // Back to RGB565, stored little-endian
+    for (int x = 0; x < this->width_; x++, px += 3, out += 2)
+      write_le16(out, bgr_to_rgb565(px));
+    if (this->width_ & 1)
+      write_le16(out, 0);
+  }
+}
+
+// ============================================================================
+// Rle8EncoderSink
+// ============================================================================
+
+/// Slots in the colour table -- twice the palette, so probes stay short.
+static const uint32_t RLE8_TABLE_SLOTS = 512;
+static const uint32_t RLE8_SLOT_VALID = 1u << 31;
+
+bool Rle8EncoderSink::begin(int width, int height) {
+  this->width_ = width;
+  this->height_ = height;
+  this->pos_ = BMP_RLE8_HEADER_SIZE;
+  this->overflow_ = false;
+  this->colors_ = 0;
+  this->slots_.assign(RLE8_TABLE_SLOTS, 0);
+  memset(this->out_ + 54, 0, 256 * 4);  // palette, filled as colours appear
+  this->row_.resize(width);
+  this->row_ends_.clear();
+  this->row_ends_.reserve(height);
+  return true;
+}
+
+int Rle8EncoderSink::palette_index_(uint16_t key, const uint8_t *bgr) {
+  uint32_t slot = (uint32_t) (key * 2654435761u) >> 23;  // top 9 bits: 0..511
+  while (true) {
+    uint32_t entry = this->slots_[slot];
+    if (!(entry & RLE8_SLOT_VALID))
+      break;
+    if (((entry >> 8) & 0xFFFF) == key)
+      return entry & 0xFF;
+    slot = (slot + 1) % RLE8_TABLE_SLOTS;
+  }
+  if (this->colors_ == 256)
+    return -1;
+  int index = this->colors_++;
+  this->slots_[slot] = RLE8_SLOT_VALID | (uint32_t) key << 8 | index;
+  uint8_t *entry = this->out_ + 54 + index * 4;  // palette entries are B, G, R, 0
+  entry[0] = bgr[0];
+  entry[1] = bgr[1];
+  entry[2] = bgr[2];
+  entry[3] = 0;
+  return index;
+}
+
+void Rle8EncoderSink::strip(int y, int count, const uint8_t *rows, int stride) {
+  for (int i = 0; i < count && !this->overflow_; i++) {
+    const uint8_t *px = rows + (size_t) i * stride;
+    uint16_t prev_key = 0;
+    int prev_index = -1;
+    for (int x = 0; x < this->width_; x++, px += 3) {
+      // Runs skip the table lookup.
+      uint16_t key = bgr_to_rgb565(px);
+      if (prev_index < 0 || key != prev_key) {
+        prev_index = this->palette_index_(key, px);
+        prev_key = key;
+        if (prev_index < 0) {
+          this->overflow_ = true;
+          return;
+        }
+      }
+      this->row_[x] = prev_index;
+    }
+    this->encode_row_();
+  }
+}
+
+void Rle8EncoderSink::encode_row_() {
+  const uint8_t *idx = this->row_.data();
+  uint8_t *out = this->out_;
+  int w = this->width_;
+  int x = 0;
+  while (x < w) {
+    int run = 1;
+    while (x + run < w && run < 255 && idx[x + run] == idx[x])
+      run++;
+    if (run >= 2) {
+      out[this->pos_++] = run;
+      out[this->pos_++] = idx[x];
+      x += run;
+      continue;
+    }
+    // Literal stretch: up to where the next run of two or more starts.
+    int n = 1;
+    while (x + n < w && n < 255 && !(x + n + 1 < w && idx[x + n] == idx[x + n + 1]))
+      n++;
+    if (n < 3) {
+      // Absolute mode needs at least 3 pixels; shorter stretches are runs of 1.
+      for (int i = 0; i < n; i++) {
+        out[this->pos_++] = 1;
+        out[this->pos_++] = idx[x + i];
+      }
+    } else {
+      out[this->pos_++] = 0;
+      out[this->pos_++] = n;
+      memcpy(out + this->pos_, idx + x, n);
+      this->pos_ += n;
+      if (n & 1)
+        out[this->pos_++] = 0;  // absolute runs are padded to 16 bits
+    }
+    x += n;
+  }
+  out[this->pos_++] = 0;  // end of line
+  out[this->pos_++] = 0;
+  this->row_ends_.push_back(this->pos_);
+}
+
+void Rle8EncoderSink::end() {
+  this->slots_.clear();
+  this->slots_.shrink_to_fit();
+  this->row_.clear();
+  this->row_.shrink_to_fit();
+  if (this->overflow_)
+    return;
+
+  // Top-down rows to bottom-up: reverse all encoded bytes, then each row's
+  // bytes back into order -- in place, without a second buffer.
+  uint8_t *data = this->out_ + BMP_RLE8_HEADER_SIZE;
+  uint32_t total = this->pos_ - BMP_RLE8_HEADER_SIZE;
+  std::reverse(data, data + total);
+  uint32_t start = 0;
+  for (uint32_t end : this->row_ends_) {
+    end -= BMP_RLE8_HEADER_SIZE;
+    std::reverse(data + total - end, data + total - start);
+    start = end;
+  }
+  this->row_ends_.clear();
+  this->row_ends_.shrink_to_fit();
+  this->out_[this->pos_++] = 0;  // end of bitmap
+  this->out_[this->pos_++] = 1;
+
+  // BI_RLE8 needs bottom-up rows (positive height).
+  write_bmp_headers(this->out_, this->width_, this->height_, 8, 1, BMP_RLE8_HEADER_SIZE,
+                    this->pos_ - BMP_RLE8_HEADER_SIZE, this->colors_);
+}
+
+// ============================================================================
+// DownscaleSink
+// ============================================================================
+
+bool DownscaleSink::begin(int width, int height) {
+  this->width_ = width;
+  this->height_ = height;
+  this->out_w_ = output_dimension(width, this->factor_);
+  this->out_h_ = output_dimension(height, this->factor_);
+  this->out_y_ = 0;
+  this->rows_summed_ = 0;
+  this->sums_.assign(this->out_w_ * 3, 0);
+  this->row_.assign(bmp_row_stride(this->out_w_), 0);
+  return this->next_->begin(this->out_w_, this->out_h_);
+}
+
+void DownscaleSink::strip(int y, int count, const uint8_t *rows, int stride) {
+  for (int i = 0; i < count; i++) {
+    if ((y + i) / this->factor_ != this->out_y_)
+      this->flush_row_();
+    const uint8_t *src = rows + (size_t) i * stride;
+    for (int x = 0; x < this->width_; x++, src += 3) {
+      uint32_t *sum = &this->sums_[(x / this->factor_) * 3];
+      sum[0] += src[0];
+      sum[1] += src[1];
+      sum[2] += src[2];
+    }
+    this->rows_summed_++;
+  }
+}
+
+void DownscaleSink::end() {
+  if (this->rows_summed_ > 0)
+    this->flush_row_();
+  this->sums_.clear();
+  this->sums_.shrink_to_fit();
+  this->row_.clear();
+  this->row_.shrink_to_fit();
+  this->next_->end();
+}
+
+void DownscaleSink::flush_row_() {
+  // Box filter: average over the factor x factor block, clipped at the frame edge.
+  // The row padding stays zero from begin().
+  uint8_t *out_row = this->row_.data();
+  for (int ox = 0; ox < this->out_w_; ox++) {
+    int cols = std::min(this->factor_, this->width_ - ox * this->factor_);
+    uint32_t n = cols * this->rows_summed_;
+    uint32_t *sum = &this->sums_[ox * 3];
+    out_row[ox * 3 + 0] = sum[0] / n;
+    out_row[ox * 3 + 1] = sum[1] / n;
+    out_row[ox * 3 + 2] = sum[2] / n;
+    sum[0] = sum[1] = sum[2] = 0;
+  }
+  this->next_->strip(this->out_y_, 1, out_row, this->row_.size());
+  this->out_y_++;
+  this->rows_summed_ = 0;
+}
+
+// ============================================================================
+// CropSink
+// ============================================================================
+
+bool CropSink::begin(int width, int height) {
+  if (this->x_ < 0 || this->y_ < 0 || this->w_ <= 0 || this->h_ <= 0 || this->x_ + this->w_ > width ||
+      this->y_ + this->h_ > height)
+    return false;
+  this->row_.assign(bmp_row_stride(this->w_), 0);
+  return this->next_->begin(this->w_, this->h_);
+}
+
+void CropSink::strip(int y, int count, const uint8_t *rows, int stride) {
+  // Row by row: the cropped rows need their own stride and zeroed padding.
+  int first = std::max(y, this->y_);
+  int last = std::min(y + count, this->y_ + this->h_);
+  for (int ry = first; ry < last; ry++) {
+    memcpy(this->row_.data(), rows + (size_t) (ry - y) * stride + this->x_ * 3, this->w_ * 3);
+    this->next_->strip(ry - this->y_, 1, this->row_.data(), this->row_.size());
+  }
+}
+
+// ============================================================================
+// HashSink
+// ============================================================================
+
+bool HashSink::begin(int width, int height) {
+  this->width_ = width;
+  this->hash_ = fnv1a_32_u32(height, fnv1a_32_u32(width, FNV_OFFSET_BASIS));
+  this->tile_hashes_.clear();
+  if (this->tile_size_ > 0) {
+    this->grid_.width = width;
+    this->grid_.height = height;
+    this->grid_.tile_size = this->tile_size_;
+    int max_z = this->grid_.max_zoom();
+    this->tile_hashes_.assign(max_z + 1, {});
+    this->tile_hashes_[max_z].assign(this->grid_.cols(max_z) * this->grid_.rows(max_z), FNV_OFFSET_BASIS);
+  }
+  return true;
+}
+
+void HashSink::strip(int y, int count, const uint8_t *rows, int stride) {
+  int row_bytes = this->width_ * 3;
+  for (int i = 0; i < count; i++) {
+    const uint8_t *row = rows + (size_t) i * stride;
+    this->hash_ = fnv1a_32(row, row_bytes, this->hash_);
+    if (this->tile_hashes_.empty())
+      continue;
+
+    // Full resolution: each tile hashes its slice of every row it covers.
+    int max_z = this->tile_hashes_.size() - 1;
+    int cols = this->grid_.cols(max_z);
+    int tile = this->tile_size_;
+    uint32_t *hashes = &this->tile_hashes_[max_z][((y + i) / tile) * cols];
+    for (int tx = 0; tx < cols; tx++) {
+      int x0 = tx * tile;
+      int x1 = std::min(x0 + tile, this->width_);
+      hashes[tx] = fnv1a_32(row + x0 * 3, (x1 - x0) * 3, hashes[tx]);
+    }
+  }
+}
+
+void HashSink::end() {
+  // Lower levels: hash of the child hashes.
+  for (int z = (int) this->tile_hashes_.size() - 2; z >= 0; z--) {
+    int level_cols = this->grid_.cols(z);
+    int level_rows = this->grid_.rows(z);
+    int child_cols = this->grid_.cols(z + 1);
+    int child_rows = this->grid_.rows(z + 1);
+    const auto &children = this->tile_hashes_[z + 1];
+    auto &level = this->tile_hashes_[z];
+    level.resize(level_cols * level_rows);
+    for (int ty = 0; ty < level_rows; ty++) {
+      for (int tx = 0; tx < level_cols; tx++) {
+        uint32_t hash = FNV_OFFSET_BASIS;
+        for (int cy = ty * 2; cy < std::min(ty * 2 + 2, child_rows); cy++) {
+          for (int cx = tx * 2; cx < std::min(tx * 2 + 2, child_cols); cx++)
+            hash = fnv1a_32_u32(children[cy * child_cols + cx], hash);
+        }
+        level[ty * level_cols + tx] = hash;
+      }
+    }
+  }
+}
+
+// ============================================================================
+// HistogramSink
+// ============================================================================
+
+bool HistogramSink::begin(int width, int height) {
+  this->width_ = width;
+  this->colors_ = 0;
+  this->runs_ = 0;
+  this->seen_.assign(65536 / 8, 0);
+  return true;
+}
+
+void HistogramSink::strip(int y, int count, const uint8_t *rows, int stride) {
+  for (int i = 0; i < count; i++) {
+    const uint8_t *px = rows + (size_t) i * stride;
+    uint32_t prev = UINT32_MAX;
+    for (int x = 0; x < this->width_; x++, px += 3) {
+      uint32_t key = bgr_to_rgb565(px);
+      uint8_t bit = 1 << (key & 7);
+      if (!(this->seen_[key >> 3] & bit)) {
+        this->seen_[key >> 3] |= bit;
+        this->colors_++;
+      }
+      if (key != prev)
+        this->runs_++;
+      prev = key;
+    }
+  }
+}
+
+void HistogramSink::end() {
+  this->seen_.clear();
+  this->seen_.shrink_to_fit();
+}
+
+// ============================================================================
+// RegionWatchSink
+// ============================================================================
+
+bool RegionWatchSink::begin(int width, int height) {
+  // Clip to the frame; an empty region still gets a (constant) hash.
+  int x1 = std::min(this->x_ + this->w_, width);
+  int y1 = std::min(this->y_ + this->h_, height);
+  this->x_ = std::max(this->x_, 0);
+  this->y_ = std::max(this->y_, 0);
+  this->w_ = std::max(x1 - this->x_, 0);
+  this->h_ = std::max(y1 - this->y_, 0);
+  this->hash_ = fnv1a_32_u32(this->h_, fnv1a_32_u32(this->w_, FNV_OFFSET_BASIS));
+  return true;
+}
+
+void RegionWatchSink::strip(int y, int count, const uint8_t *rows, int stride) {
+  int first = std::max(y, this->y_);
+  int last = std::min(y + count, this->y_ + this->h_);
+  for (int ry = first; ry < last; ry++)
+    this->hash_ = fnv1a_32(rows + (size_t) (ry - y) * stride + this->x_ * 3, this->w_ * 3, this->hash_);
+}
+
+// ============================================================================
+// Rle565Sink
+// ============================================================================
+
+bool Rle565Sink::begin(int width, int height) {
+  this->width_ = width;
+  return true;
+}
+
+void Rle565Sink::strip(int y, int count, const uint8_t *rows, int stride) {
+  for (int i = 0; i < count; i++) {
+    const uint8_t *px = rows + (size_t) i * stride;
+    for (int x = 0; x < this->width_; x++, px += 3)
+      this->encoder_.push(bgr_to_rgb565(px));
+  }
+}
+
+}  // namespace display_capture
+}  // namespace esphome
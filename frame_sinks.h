@@ -0,0 +1,321 @@
+// display_capture -- frame sinks for the single-pass capture pipeline.
+//
+// DisplayCaptureHandler reads the framebuffer once per capture, converting
+// strips of rows to BGR888 in internal SRAM, and hands each strip to every
+// sink attached to that capture. Secondary outputs (hashes, statistics,
+// thumbnails) therefore cost compute only -- never another PSRAM pass.
+//
+// Sinks are plain objects created on the stack for a single capture. They
+// never touch display internals, so this file needs no access hacks.
+
+#pragma once
+
+#include "serial_protocol.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace esphome {
+namespace display_capture {
+
+static const uint32_t FNV_OFFSET_BASIS = 2166136261UL;
+
+/// 32-bit FNV-1a hash. Pass a previous result as `hash` to continue hashing.
+inline uint32_t fnv1a_32(const uint8_t *data, size_t len, uint32_t hash = FNV_OFFSET_BASIS) {
+  for (size_t i = 0; i < len; i++) {
+    hash ^= data[i];
+    hash *= 16777619UL;
+  }
+  return hash;
+}
+
+/// Continues an FNV-1a hash with a 32-bit value (little-endian).
+inline uint32_t fnv1a_32_u32(uint32_t value, uint32_t hash) {
+  uint8_t bytes[4] = {(uint8_t) value, (uint8_t) (value >> 8), (uint8_t) (value >> 16), (uint8_t) (value >> 24)};
+  return fnv1a_32(bytes, sizeof(bytes), hash);
+}
+
+/// Write a 32-bit value in little-endian byte order (for BMP headers).
+inline void write_le32(uint8_t *p, uint32_t v) {
+  p[0] = v & 0xFF;
+  p[1] = (v >> 8) & 0xFF;
+  p[2] = (v >> 16) & 0xFF;
+  p[3] = (v >> 24) & 0xFF;
+}
+
+/// Write a 16-bit value in little-endian byte order (for BMP headers).
+inline void write_le16(uint8_t *p, uint16_t v) {
+  p[0] = v & 0xFF;
+  p[1] = (v >> 8) & 0xFF;
+}
+
+/// A strip pixel (B, G, R) back to the RGB565 it was expanded from. The
+/// expansion is exact, so this is lossless.
+inline uint16_t bgr_to_rgb565(const uint8_t *px) {
+  return ((px[2] >> 3) << 11) | ((px[1] >> 2) << 5) | (px[0] >> 3);
+}
+
+/// BMP row stride for a 24-bit image -- rows are padded to 4 bytes.
+inline int bmp_row_stride(int width) { return ((width * 3 + 3) / 4) * 4; }
+
+/// Size in bytes of a 24-bit BMP file (54-byte headers + padded rows).
+inline uint32_t bmp_file_size(int width, int height) { return 54 + bmp_row_stride(width) * height; }
+
+/// Writes the 54-byte BMP file + DIB header for a 24-bit bottom-up image.
+void write_bmp_header(uint8_t *out, int width, int height);
+
+/// Header size of a 16-bit BMP: file + DIB header plus the three BI_BITFIELDS masks.
+static const uint32_t BMP16_HEADER_SIZE = 66;
+
+/// BMP row stride for a 16-bit image -- rows are padded to 4 bytes.
+inline int bmp16_row_stride(int width) { return ((width * 2 + 3) / 4) * 4; }
+
+/// Size in bytes of a 16-bit (RGB565) BMP file.
+inline uint32_t bmp16_file_size(int width, int height) {
+  return BMP16_HEADER_SIZE + bmp16_row_stride(width) * height;
+}
+
+/// Writes the 66-byte header of a 16-bit bottom-up RGB565 BMP (BI_BITFIELDS).
+void write_bmp16_header(uint8_t *out, int width, int height);
+
+/// Header size of an 8-bit RLE BMP: file + DIB header plus a 256-entry palette.
+static const uint32_t BMP_RLE8_HEADER_SIZE = 54 + 256 * 4;
+
+/// Geometry of the /screenshot/tile pyramid for a frame.
+///
+/// Zoom levels follow the web-map convention: z=0 is the most zoomed-out
+/// level (the whole frame fits in one tile), z=max_zoom() is full resolution,
+/// and each level down halves the resolution. Tile (x, y) counts from the
+/// top-left.
+struct TileGrid {
+  int width{0};
+  int height{0};
+  int tile_size{64};
+
+  int max_zoom() const;
+  /// Downscale factor (power of two) of zoom level z.
+  int scale(int z) const { return 1 << (this->max_zoom() - z); }
+  int level_width(int z) const { return (this->width + this->scale(z) - 1) / this->scale(z); }
+  int level_height(int z) const { return (this->height + this->scale(z) - 1) / this->scale(z); }
+  int cols(int z) const { return (this->level_width(z) + this->tile_size - 1) / this->tile_size; }
+  int rows(int z) const { return (this->level_height(z) + this->tile_size - 1) / this->tile_size; }
+};
+
+/// Receives one frame as strips of BGR888 rows, top row first.
+class FrameSink {
+ public:
+  virtual ~FrameSink() = default;
+  /// Called once before the first strip. Returning false aborts the capture.
+  virtual bool begin(int width, int height) { return true; }
+  /// `rows` holds `count` screen rows starting at row `y`, `stride` bytes
+  /// apart (the BMP row stride, with padding zeroed). Only valid during the call.
+  virtual void strip(int y, int count, const uint8_t *rows, int stride) = 0;
+  /// Called once after the last strip.
+  virtual void end() {}
+  /// Bytes written to the output buffer (PSRAM) by this capture, valid after end().
+  virtual size_t get_written_bytes() const { return 0; }
+};
+
+/// Writes the frame as a complete 24-bit BMP into a caller-provided buffer of
+/// bmp_file_size(width, height) bytes.
+class BmpEncoderSink : public FrameSink {
+ public:
+  explicit BmpEncoderSink(uint8_t *out) : out_(out) {}
+  bool begin(int width, int height) override;
+  void strip(int y, int count, const uint8_t *rows, int stride) override;
+  size_t get_written_bytes() const override { return this->size_; }
+
+ protected:
+  uint8_t *out_;
+  int height_{0};
+  uint32_t size_{0};
+};
+
+/// Writes the frame as a 16-bit RGB565 BMP into a caller-provided buffer of
+/// bmp16_file_size(width, height) bytes. Lossless for RGB565 framebuffers, at
+/// two thirds of the 24-bit size.
+class Bmp16EncoderSink : public FrameSink {
+ public:
+  explicit Bmp16EncoderSink(uint8_t *out) : out_(out) {}
+  bool begin(int width, int height) override;
+  void strip(int y, int count, const uint8_t *rows, int stride) override;
+  size_t get_written_bytes() const override { return bmp16_file_size(this->width_, this->height_); }
+
+ protected:
+  uint8_t *out_;
+  int width_{0};
+  int height_{0};
+};
+
+/// Writes the frame as an 8-bit palette BMP with BI_RLE8 compression into a
+/// caller-provided buffer of max_file_size() bytes. Flat UI screens with few
+/// colours and long runs shrink far below bmp16.
+///
+/// The palette is built while encoding. The 257th distinct colour sets
+/// overflowed() and the rest of the frame is skipped; the buffer is then
+/// unusable and the frame has to be encoded in another format. Rows are
+/// encoded top-down as they arrive and reversed in end(), since compressed
+/// BMPs must be bottom-up.
+class Rle8EncoderSink : public FrameSink {
+ public:
+  explicit Rle8EncoderSink(uint8_t *out) : out_(out) {}
+  /// Worst case: every pixel as a 2-byte pair, an end-of-line per row, end-of-bitmap.
+  static uint32_t max_file_size(int width, int height) {
+    return BMP_RLE8_HEADER_SIZE + (2 * width + 2) * height + 2;
+  }
+  bool begin(int width, int height) override;
+  void strip(int y, int count, const uint8_t *rows, int stride) override;
+  void end() override;
+
+  /// The frame has more than 256 colours and was not encoded.
+  bool overflowed() const { return this->overflow_; }
+  /// Size of the finished file, valid after end().
+  uint32_t get_size() const { return this->pos_; }
+  size_t get_written_bytes() const override { return this->pos_; }
+
+ protected:
+  /// Palette index of an RGB565 colour, adding it (from `bgr`) if new. Returns -1 on overflow.
+  int palette_index_(uint16_t key, const uint8_t *bgr);
+  /// Appends one row of palette indices in RLE8 (runs, absolute runs, end-of-line).
+  void encode_row_();
+
+  uint8_t *out_;
+  int width_{0};
+  int height_{0};
+  uint32_t pos_{0};             ///< Write position in out_
+  bool overflow_{false};
+  int colors_{0};               ///< Palette entries used
+  std::vector<uint32_t> slots_;  ///< Open-addressed colour table: valid bit | key << 8 | index
+  std::vector<uint8_t> row_;     ///< Palette indices of the row being encoded
+  std::vector<uint32_t> row_ends_;  ///< End offset of each encoded row (top-down)
+};
+
+/// Box-filters the frame down by an integer factor and passes the smaller
+/// frame on to `next` (an encoder), one output row at a time.
+class DownscaleSink : public FrameSink {
+ public:
+  DownscaleSink(FrameSink *next, int factor) : next_(next), factor_(factor) {}
+  static int output_dimension(int size, int factor) { return (size + factor - 1) / factor; }
+  bool begin(int width, int height) override;
+  void strip(int y, int count, const uint8_t *rows, int stride) override;
+  void end() override;
+  size_t get_written_bytes() const override { return this->next_->get_written_bytes(); }
+
+ protected:
+  /// Passes on the accumulated output row and clears the sums.
+  void flush_row_();
+
+  FrameSink *next_;
+  int factor_;
+  int width_{0};
+  int height_{0};
+  int out_w_{0};
+  int out_h_{0};
+  int out_y_{0};                ///< Output row being accumulated
+  int rows_summed_{0};          ///< Source rows added to sums_ so far
+  std::vector<uint32_t> sums_;  ///< Per output column: B, G, R sums
+  std::vector<uint8_t> row_;    ///< Output row handed to next_
+};
+
+/// Passes only a rectangle of the frame on to `next`, as a frame of its own.
+/// The rectangle must lie inside the frame (begin() fails otherwise).
+class CropSink : public FrameSink {
+ public:
+  CropSink(FrameSink *next, int x, int y, int w, int h) : next_(next), x_(x), y_(y), w_(w), h_(h) {}
+  bool begin(int width, int height) override;
+  void strip(int y, int count, const uint8_t *rows, int stride) override;
+  void end() override { this->next_->end(); }
+  size_t get_written_bytes() const override { return this->next_->get_written_bytes(); }
+
+ protected:
+  FrameSink *next_;
+  int x_, y_, w_, h_;
+  std::vector<uint8_t> row_;  ///< Cropped row with zeroed padding, handed to next_
+};
+
+/// Frame content hash, plus optional per-tile hashes for the tile pyramid.
+///
+/// The frame hash is FNV-1a over the dimensions and every row's pixels.
+/// Full-resolution tile hashes cover each tile's slice of its
+/// rows; a lower level's tile hash is the hash of its (up to four) children,
+/// so a change anywhere propagates up without re-reading pixels.
+class HashSink : public FrameSink {
+ public:
+  /// Enables tile hashes with the given tile size (0 = frame hash only).
+  void set_tile_size(int tile_size) { this->tile_size_ = tile_size; }
+  bool begin(int width, int height) override;
+  void strip(int y, int count, const uint8_t *rows, int stride) override;
+  void end() override;
+
+  uint32_t get_hash() const { return this->hash_; }
+  /// Tile hashes as [z][y * cols + x]; empty unless tiles were enabled.
+  std::vector<std::vector<uint32_t>> &get_tile_hashes() { return this->tile_hashes_; }
+
+ protected:
+  int tile_size_{0};
+  int width_{0};
+  TileGrid grid_;
+  uint32_t hash_{FNV_OFFSET_BASIS};
+  std::vector<std::vector<uint32_t>> tile_hashes_;
+};
+
+/// Colour statistics: distinct colours and horizontal runs of equal pixels.
+/// Both are cheap signals of how well a frame will compress.
+class HistogramSink : public FrameSink {
+ public:
+  bool begin(int width, int height) override;
+  void strip(int y, int count, const uint8_t *rows, int stride) override;
+  void end() override;
+
+  /// Number of distinct colours in the frame.
+  uint32_t get_colors() const { return this->colors_; }
+  /// Number of horizontal runs (a run ends at every colour change and row end).
+  uint32_t get_runs() const { return this->runs_; }
+
+ protected:
+  int width_{0};
+  uint32_t colors_{0};
+  uint32_t runs_{0};
+  /// One bit per RGB565 colour. The framebuffer is RGB565, so every BGR888
+  /// pixel maps back to exactly one 565 value.
+  std::vector<uint8_t> seen_;
+};
+
+/// Hashes a rectangle of the frame, for cheap "did this region change" checks.
+class RegionWatchSink : public FrameSink {
+ public:
+  RegionWatchSink(int x, int y, int w, int h) : x_(x), y_(y), w_(w), h_(h) {}
+  bool begin(int width, int height) override;
+  void strip(int y, int count, const uint8_t *rows, int stride) override;
+
+  uint32_t get_hash() const { return this->hash_; }
+
+ protected:
+  int x_, y_, w_, h_;
+  uint32_t hash_{FNV_OFFSET_BASIS};
+};
+
+/// Encodes the frame as RLE565 (see serial_protocol.h) into a caller-provided
+/// buffer of max_encoded_size() bytes, for the serial transport.
+class Rle565Sink : public FrameSink {
+ public:
+  explicit Rle565Sink(uint8_t *out) : encoder_(out) {}
+  static size_t max_encoded_size(int width, int height) {
+    return Rle565Encoder::max_encoded_size((size_t) width * height);
+  }
+  bool begin(int width, int height) override;
+  void strip(int y, int count, const uint8_t *rows, int stride) override;
+  void end() override { this->encoder_.finish(); }
+
+  /// Encoded size, valid after end().
+  size_t get_size() const { return this->encoder_.size(); }
+  size_t get_written_bytes() const override { return this->encoder_.size(); }
+
+ protected:
+  Rle565Encoder encoder_;
+  int width_{0};
+};
+
+}  // namespace display_capture
+}  // namespace esphome
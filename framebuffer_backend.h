@@ -0,0 +1,128 @@
+// display_capture -- framebuffer backends.
+//
+// A backend describes where a display driver keeps its pixels, so the capture
+// pipeline can read any frame-buffered driver without knowing about it. Per
+// frame, the pipeline calls begin_capture() to get a FramebufferInfo, reads
+// the pixels (straight from `base`, or through read_rect() in strips), then
+// calls end_capture().
+//
+// This header only uses forward declarations. Backends that need driver
+// internals are implemented in framebuffer_backends.cpp, the one translation
+// unit that uses the #define protected public hack.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+struct SDL_Texture;
+
+namespace esphome {
+namespace display {
+class Display;
+}  // namespace display
+
+namespace display_capture {
+
+/// Pixel layouts a backend can expose.
+enum PixelFormat {
+  PIXEL_FORMAT_RGB565,  ///< 16 bits per pixel: RRRRRGGG GGGBBBBB
+};
+
+/// Memory order of the two bytes of a 16-bit pixel.
+enum ByteOrder {
+  BYTE_ORDER_BIG_ENDIAN,     ///< High byte first (DisplayBuffer BITS_16, rpi_dpi_rgb)
+  BYTE_ORDER_LITTLE_ENDIAN,  ///< Low byte first (native uint16_t on ESP32 and hosts)
+};
+
+/// Describes one framebuffer for the duration of a capture.
+struct FramebufferInfo {
+  const uint8_t *base{nullptr};  ///< First pixel, or nullptr if only read_rect() works
+  int width{0};                  ///< Native (pre-rotation) width in pixels
+  int height{0};                 ///< Native (pre-rotation) height in pixels
+  size_t stride{0};              ///< Bytes from one native row to the next
+  PixelFormat format{PIXEL_FORMAT_RGB565};
+  ByteOrder byte_order{BYTE_ORDER_BIG_ENDIAN};
+};
+
+/// Framebuffer access for one display driver.
+class FramebufferBackend {
+ public:
+  explicit FramebufferBackend(display::Display *display) : display_(display) {}
+  virtual ~FramebufferBackend() = default;
+
+  /// YAML name of the backend, for logs and /screenshot/info.
+  virtual const char *get_name() const = 0;
+
+  /// Called on the main loop before a frame is read. Fills `info` and returns
+  /// true, or logs why the framebuffer is unavailable and returns false.
+  virtual bool begin_capture(FramebufferInfo &info) = 0;
+
+  /// Copies the native rectangle (x, y, w, h) into `dst`, rows packed at
+  /// w * 2 bytes. The default reads from info.base; backends without a
+  /// readable base pointer override this.
+  virtual void read_rect(const FramebufferInfo &info, int x, int y, int w, int h, uint8_t *dst);
+
+  /// Called after the frame has been read (also after a failed read).
+  virtual void end_capture() {}
+
+ protected:
+  display::Display *display_;
+};
+
+/// Standard DisplayBuffer (ILI9XXX, ST7789V, etc.) in BITS_16 mode.
+class DisplayBufferBackend : public FramebufferBackend {
+ public:
+  using FramebufferBackend::FramebufferBackend;
+  const char *get_name() const override { return "display_buffer"; }
+  bool begin_capture(FramebufferInfo &info) override;
+};
+
+/// rpi_dpi_rgb (ESP32-S3 RGB LCD panels) -- reads the panel's DMA framebuffer.
+class RpiDpiRgbBackend : public FramebufferBackend {
+ public:
+  using FramebufferBackend::FramebufferBackend;
+  const char *get_name() const override { return "rpi_dpi_rgb"; }
+  bool begin_capture(FramebufferInfo &info) override;
+};
+
+/// sdl (host builds) -- the display's pixels live in a write-only SDL texture,
+/// so each capture renders it into a texture of its own and reads that back.
+class SdlBackend : public FramebufferBackend {
+ public:
+  using FramebufferBackend::FramebufferBackend;
+  ~SdlBackend() override;
+  const char *get_name() const override { return "sdl"; }
+  bool begin_capture(FramebufferInfo &info) override;
+
+ protected:
+  SDL_Texture *target_{nullptr};  ///< Render target the display's texture is copied into
+  int width_{0};
+  int height_{0};
+  std::vector<uint8_t> buffer_;   ///< Pixels read back from target_
+};
+
+/// Serves a generated little-endian RGB565 test pattern at the display's
+/// native size. Lets the endpoints run on displays without a readable
+/// framebuffer.
+class MockFramebufferBackend : public FramebufferBackend {
+ public:
+  using FramebufferBackend::FramebufferBackend;
+  const char *get_name() const override { return "mock"; }
+  bool begin_capture(FramebufferInfo &info) override;
+
+ protected:
+  /// Eight vertical colour bars, a grey ramp across the top eighth, and a
+  /// white marker at native (0, 0) so the rotation is visible.
+  void draw_test_pattern_();
+  /// Writes one pixel (native coordinates) of the pattern.
+  void set_pixel_(int x, int y, uint16_t rgb565);
+
+  int width_{0};
+  int height_{0};
+  std::vector<uint8_t> buffer_;
+};
+
+}  // namespace display_capture
+}  // namespace esphome
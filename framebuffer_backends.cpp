@@ -0,0 +1,210 @@
+// display_capture -- framebuffer backend implementations.
+//
+// IMPORTANT: The #define protected public hack MUST be the very first thing
+// in this file, before any #include. It makes DisplayBuffer::buffer_,
+// RpiDpiRgb::handle_ and the SDL display's renderer accessible in this
+// translation unit only. Every other
+// file of the component uses public APIs and framebuffer_backend.h.
+//
+// This works because each .cpp is a separate translation unit with its own
+// #pragma once state. The macro only affects headers included in THIS file.
+
+// --- Step 1: Expose protected members for buffer access ---
+// USE_RPI_DPI_RGB comes from esphome/core/defines.h, which display.h pulls
+// in, so the rpi_dpi_rgb header can be included under the hack as well.
+#define protected public
+#include "esphome/components/display/display_buffer.h"
+#include "esphome/components/display/display.h"
+#ifdef USE_RPI_DPI_RGB
+#include "esphome/components/rpi_dpi_rgb/rpi_dpi_rgb.h"
+#endif
+// DISPLAY_CAPTURE_USE_SDL is defined by __init__.py for backend: sdl, the
+// only builds that have the sdl component's headers.
+#ifdef DISPLAY_CAPTURE_USE_SDL
+#include "esphome/components/sdl/sdl_esphome.h"
+#endif
+#undef protected
+
+// --- Step 2: Our own headers (forward declarations only) ---
+#include "framebuffer_backend.h"
+#include "display_capture.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace esphome {
+namespace display_capture {
+
+void FramebufferBackend::read_rect(const FramebufferInfo &info, int x, int y, int w, int h, uint8_t *dst) {
+  // Rows that span the full width are contiguous in the framebuffer.
+  if (x == 0 && w == info.width && info.stride == (size_t) w * 2) {
+    memcpy(dst, info.base + (size_t) y * info.stride, (size_t) w * h * 2);
+    return;
+  }
+  for (int r = 0; r < h; r++)
+    memcpy(dst + (size_t) r * w * 2, info.base + (size_t) (y + r) * info.stride + (size_t) x * 2, (size_t) w * 2);
+}
+
+// ============================================================================
+// DisplayBuffer
+// ============================================================================
+
+bool DisplayBufferBackend::begin_capture(FramebufferInfo &info) {
+  // dynamic_cast is unavailable with -fno-rtti, so we use static_cast.
+  auto *display_buffer = static_cast<display::DisplayBuffer *>(this->display_);
+  if (display_buffer->buffer_ == nullptr) {
+    ESP_LOGE(TAG, "Display buffer is not allocated");
+    return false;
+  }
+  info.base = display_buffer->buffer_;
+  info.width = this->display_->get_native_width();
+  info.height = this->display_->get_native_height();
+  info.stride = (size_t) info.width * 2;
+  info.format = PIXEL_FORMAT_RGB565;
+  info.byte_order = BYTE_ORDER_BIG_ENDIAN;  // BITS_16 stores the high byte first
+  return true;
+}
+
+// ============================================================================
+// rpi_dpi_rgb
+// ============================================================================
+
+bool RpiDpiRgbBackend::begin_capture(FramebufferInfo &info) {
+#ifdef USE_RPI_DPI_RGB
+  auto *rgb_display = static_cast<rpi_dpi_rgb::RpiDpiRgb *>(this->display_);
+  if (rgb_display->handle_ == nullptr) {
+    ESP_LOGE(TAG, "rpi_dpi_rgb handle is null");
+    return false;
+  }
+  // The driver allocates a single framebuffer, so buffer 0 is the one on screen.
+  void *fb = nullptr;
+  esp_err_t err = esp_lcd_rgb_panel_get_frame_buffer(rgb_display->handle_, 1, &fb);
+  if (err != ESP_OK || fb == nullptr) {
+    ESP_LOGE(TAG, "Failed to get rpi_dpi_rgb frame buffer (%d)", err);
+    return false;
+  }
+  info.base = static_cast<const uint8_t *>(fb);
+  info.width = this->display_->get_native_width();
+  info.height = this->display_->get_native_height();
+  info.stride = (size_t) info.width * 2;
+  info.format = PIXEL_FORMAT_RGB565;
+  info.byte_order = BYTE_ORDER_BIG_ENDIAN;  // draw_pixel_at() stores convert_big_endian() values
+  return true;
+#else
+  ESP_LOGE(TAG, "rpi_dpi_rgb backend requested but USE_RPI_DPI_RGB is not enabled in this build");
+  return false;
+#endif
+}
+
+// ============================================================================
+// sdl
+// ============================================================================
+
+SdlBackend::~SdlBackend() {
+#ifdef DISPLAY_CAPTURE_USE_SDL
+  if (this->target_ != nullptr)
+    SDL_DestroyTexture(this->target_);
+#endif
+}
+
+bool SdlBackend::begin_capture(FramebufferInfo &info) {
+#ifdef DISPLAY_CAPTURE_USE_SDL
+  auto *sdl_display = static_cast<sdl::Sdl *>(this->display_);
+  SDL_Renderer *renderer = sdl_display->renderer_;
+  if (renderer == nullptr || sdl_display->texture_ == nullptr) {
+    ESP_LOGE(TAG, "SDL display is not set up");
+    return false;
+  }
+  int width = this->display_->get_native_width();
+  int height = this->display_->get_native_height();
+  if (this->target_ == nullptr || width != this->width_ || height != this->height_) {
+    if (this->target_ != nullptr)
+      SDL_DestroyTexture(this->target_);
+    this->target_ = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGB565, SDL_TEXTUREACCESS_TARGET, width, height);
+    if (this->target_ == nullptr) {
+      ESP_LOGE(TAG, "Failed to create SDL capture texture: %s", SDL_GetError());
+      return false;
+    }
+    this->width_ = width;
+    this->height_ = height;
+    this->buffer_.resize((size_t) width * height * 2);
+  }
+
+  // The display draws into a static texture, which can't be locked or read.
+  // Copying it 1:1 into our target and reading that gives its pixels
+  // unscaled, whatever size the window is.
+  SDL_Texture *previous = SDL_GetRenderTarget(renderer);
+  bool ok = SDL_SetRenderTarget(renderer, this->target_) == 0 &&
+            SDL_RenderCopy(renderer, sdl_display->texture_, nullptr, nullptr) == 0 &&
+            SDL_RenderReadPixels(renderer, nullptr, SDL_PIXELFORMAT_RGB565, this->buffer_.data(), width * 2) == 0;
+  SDL_SetRenderTarget(renderer, previous);
+  if (!ok) {
+    ESP_LOGE(TAG, "Failed to read SDL display pixels: %s", SDL_GetError());
+    return false;
+  }
+  info.base = this->buffer_.data();
+  info.width = width;
+  info.height = height;
+  info.stride = (size_t) width * 2;
+  info.format = PIXEL_FORMAT_RGB565;
+  info.byte_order = BYTE_ORDER_LITTLE_ENDIAN;  // SDL_PIXELFORMAT_RGB565 is a native uint16_t
+  return true;
+#else
+  ESP_LOGE(TAG, "sdl backend requested but DISPLAY_CAPTURE_USE_SDL is not enabled in this build");
+  return false;
+#endif
+}
+
+// ============================================================================
+// Mock
+// ============================================================================
+
+bool MockFramebufferBackend::begin_capture(FramebufferInfo &info) {
+  int width = this->display_->get_native_width();
+  int height = this->display_->get_native_height();
+  if (width != this->width_ || height != this->height_) {
+    this->width_ = width;
+    this->height_ = height;
+    this->buffer_.assign((size_t) width * height * 2, 0);
+    this->draw_test_pattern_();
+  }
+  info.base = this->buffer_.data();
+  info.width = width;
+  info.height = height;
+  info.stride = (size_t) width * 2;
+  info.format = PIXEL_FORMAT_RGB565;
+  info.byte_order = BYTE_ORDER_LITTLE_ENDIAN;
+  return true;
+}
+
+void MockFramebufferBackend::set_pixel_(int x, int y, uint16_t rgb565) {
+  uint8_t *p = &this->buffer_[((size_t) y * this->width_ + x) * 2];
+  p[0] = rgb565 & 0xFF;
+  p[1] = rgb565 >> 8;
+}
+
+void MockFramebufferBackend::draw_test_pattern_() {
+  // White, yellow, cyan, green, magenta, red, blue, black
+  static const uint16_t BARS[8] = {0xFFFF, 0xFFE0, 0x07FF, 0x07E0, 0xF81F, 0xF800, 0x001F, 0x0000};
+  int ramp_h = std::max(1, this->height_ / 8);
+  for (int y = 0; y < this->height_; y++) {
+    for (int x = 0; x < this->width_; x++) {
+      uint16_t color;
+      if (y < ramp_h) {
+        uint8_t level = x * 32 / this->width_;  // 5-bit grey
+        color = (level << 11) | (level << 6) | level;
+      } else {
+        color = BARS[x * 8 / this->width_];
+      }
+      this->set_pixel_(x, y, color);
+    }
+  }
+  int marker = std::max(1, std::min(this->width_, this->height_) / 16);
+  for (int y = 0; y < marker; y++) {
+    for (int x = 0; x < marker; x++)
+      this->set_pixel_(x, y, 0xFFFF);
+  }
+}
+
+}  // namespace display_capture
+}  // namespace esphome
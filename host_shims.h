@@ -0,0 +1,87 @@
+// display_capture -- FreeRTOS and heap_caps stand-ins for host builds.
+//
+// On the ESP32 the component hands requests between the HTTP task and loop()
+// with FreeRTOS semaphores and puts its large buffers in PSRAM with
+// heap_caps_malloc(). ESPHome host (Linux) builds have neither, so this
+// header maps the few calls the component makes onto the C++ standard
+// library. Only display_capture.h includes it, and only under USE_HOST.
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <mutex>
+
+namespace esphome {
+namespace display_capture {
+
+/// A binary semaphore; as a mutex it starts out given.
+struct HostSemaphore {
+  std::mutex mutex;
+  std::condition_variable given;
+  bool available{false};
+};
+
+}  // namespace display_capture
+}  // namespace esphome
+
+// ============================================================================
+// FreeRTOS semaphores
+// ============================================================================
+
+typedef esphome::display_capture::HostSemaphore *SemaphoreHandle_t;
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+
+#define pdTRUE 1
+#define pdFALSE 0
+#define portMAX_DELAY ((TickType_t) 0xFFFFFFFF)
+/// Ticks are milliseconds on the host.
+#define pdMS_TO_TICKS(ms) ((TickType_t) (ms))
+
+inline SemaphoreHandle_t xSemaphoreCreateBinary() { return new esphome::display_capture::HostSemaphore(); }
+
+inline SemaphoreHandle_t xSemaphoreCreateMutex() {
+  SemaphoreHandle_t semaphore = xSemaphoreCreateBinary();
+  semaphore->available = true;
+  return semaphore;
+}
+
+inline BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks) {
+  std::unique_lock<std::mutex> lock(semaphore->mutex);
+  auto available = [semaphore] { return semaphore->available; };
+  if (ticks == portMAX_DELAY)
+    semaphore->given.wait(lock, available);
+  else if (!semaphore->given.wait_for(lock, std::chrono::milliseconds(ticks), available))
+    return pdFALSE;
+  semaphore->available = false;
+  return pdTRUE;
+}
+
+inline BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore) {
+  {
+    std::lock_guard<std::mutex> lock(semaphore->mutex);
+    if (semaphore->available)
+      return pdFALSE;  // already given, as FreeRTOS reports it
+    semaphore->available = true;
+  }
+  semaphore->given.notify_one();
+  return pdTRUE;
+}
+
+// ============================================================================
+// heap_caps -- there is no PSRAM/internal split, the capabilities are ignored
+// ============================================================================
+
+#define MALLOC_CAP_8BIT (1 << 2)
+#define MALLOC_CAP_SPIRAM (1 << 10)
+#define MALLOC_CAP_INTERNAL (1 << 11)
+
+inline void *heap_caps_malloc(size_t size, uint32_t caps) { return malloc(size); }
+inline void *heap_caps_realloc(void *ptr, size_t size, uint32_t caps) { return realloc(ptr, size); }
+inline void heap_caps_free(void *ptr) { free(ptr); }
+/// No fixed heap to run out of; allocation failures are still handled where they happen.
+inline size_t heap_caps_get_largest_free_block(uint32_t caps) { return SIZE_MAX; }
@@ -0,0 +1,489 @@
+// display_capture -- framed binary protocol for screenshots over a serial console.
+//
+// Shared by the component (which sends) and tools/serial_receive.cpp (which
+// receives), so it is header-only and uses nothing but the C++ standard
+// library.
+//
+// A frame travels as a sequence of packets. Each packet is COBS-encoded,
+// escaped, and wrapped in zero bytes:
+//
+//   0x00 | ESCAPE( COBS( 'D' 'C' | type | frame_id | body | CRC-32 ) ) | 0x00
+//
+// COBS removes every zero byte from the packet, so 0x00 only ever marks a
+// packet boundary. ESCAPE then replaces 0x0A with 0x7D 0x2A and 0x7D with
+// 0x7D 0x5D, so no packet contains a newline: the ESP-IDF console turns
+// "\n" into "\r\n" (or "\r") on the way out, which would otherwise corrupt
+// every packet with a 0x0A in it. Log lines written to the same console
+// contain no zero bytes either; a receiver that finds a segment which is not
+// a valid packet (bad escape, COBS, magic or CRC) treats it as console text.
+// The CRC-32 covers everything before it and catches packets that a log line
+// from another task cut into.
+//
+// Packets of one frame:
+//   PACKET_FRAME_BEGIN  width u16, height u16, encoding u8, payload size u32
+//   PACKET_FRAME_DATA   offset u32, up to SERIAL_CHUNK_SIZE payload bytes
+//   PACKET_FRAME_END    CRC-32 of the whole payload u32
+//
+// All integers are little-endian. The payload is the frame in ENCODING_RLE565:
+// RGB565 pixels, top row first, run-length coded (see Rle565Encoder).
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <vector>
+
+namespace esphome {
+namespace display_capture {
+
+static const uint8_t SERIAL_MAGIC_0 = 'D';
+static const uint8_t SERIAL_MAGIC_1 = 'C';
+
+enum SerialPacketType : uint8_t {
+  PACKET_FRAME_BEGIN = 1,
+  PACKET_FRAME_DATA = 2,
+  PACKET_FRAME_END = 3,
+};
+
+enum SerialEncoding : uint8_t {
+  ENCODING_RLE565 = 1,
+};
+
+/// Payload bytes per PACKET_FRAME_DATA packet.
+static const size_t SERIAL_CHUNK_SIZE = 512;
+/// Largest packet before COBS: magic, type, frame id, data header, chunk, CRC.
+static const size_t SERIAL_MAX_PACKET = 4 + 4 + SERIAL_CHUNK_SIZE + 4;
+/// Largest COBS-encoded packet.
+static const size_t SERIAL_MAX_COBS = SERIAL_MAX_PACKET + SERIAL_MAX_PACKET / 254 + 1;
+/// Largest packet on the wire: every COBS byte escaped, plus both delimiters.
+static const size_t SERIAL_MAX_WIRE = 2 * SERIAL_MAX_COBS + 2;
+
+/// Escape byte: the next byte is XOR 0x20 of the one it stands for.
+static const uint8_t SERIAL_ESCAPE = 0x7D;
+
+/// CRC-32 (IEEE 802.3, as in zlib). Pass a previous result as `crc` to continue.
+inline uint32_t serial_crc32(const uint8_t *data, size_t len, uint32_t crc = 0) {
+  // Nibble table: 64 bytes of constants instead of 1 KB, still table-driven.
+  static const uint32_t TABLE[16] = {0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4,
+                                     0x4DB26158, 0x5005713C, 0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C,
+                                     0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C};
+  crc = ~crc;
+  for (size_t i = 0; i < len; i++) {
+    crc ^= data[i];
+    crc = (crc >> 4) ^ TABLE[crc & 0x0F];
+    crc = (crc >> 4) ^ TABLE[crc & 0x0F];
+  }
+  return ~crc;
+}
+
+inline void serial_put_le16(uint8_t *p, uint16_t v) {
+  p[0] = v & 0xFF;
+  p[1] = v >> 8;
+}
+
+inline void serial_put_le32(uint8_t *p, uint32_t v) {
+  p[0] = v & 0xFF;
+  p[1] = (v >> 8) & 0xFF;
+  p[2] = (v >> 16) & 0xFF;
+  p[3] = (v >> 24) & 0xFF;
+}
+
+inline uint16_t serial_get_le16(const uint8_t *p) { return p[0] | (p[1] << 8); }
+inline uint32_t serial_get_le32(const uint8_t *p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+/// COBS-encodes `len` bytes into `out` (at least len + len / 254 + 1 bytes).
+/// Returns the encoded size; the output contains no zero bytes.
+inline size_t cobs_encode(const uint8_t *in, size_t len, uint8_t *out) {
+  size_t code_pos = 0;
+  size_t pos = 1;
+  uint8_t code = 1;
+  for (size_t i = 0; i < len; i++) {
+    if (in[i] != 0) {
+      out[pos++] = in[i];
+      code++;
+    }
+    if (in[i] == 0 || code == 0xFF) {
+      out[code_pos] = code;
+      code_pos = pos++;
+      code = 1;
+    }
+  }
+  out[code_pos] = code;
+  return pos;
+}
+
+/// Decodes a COBS block (without delimiters) into `out` (at least `len` bytes).
+/// Returns the decoded size, or 0 if the block is malformed.
+inline size_t cobs_decode(const uint8_t *in, size_t len, uint8_t *out) {
+  size_t pos = 0;
+  size_t i = 0;
+  while (i < len) {
+    uint8_t code = in[i++];
+    if (code == 0 || i + code - 1 > len)
+      return 0;
+    for (uint8_t j = 1; j < code; j++) {
+      if (in[i] == 0)
+        return 0;
+      out[pos++] = in[i++];
+    }
+    if (code != 0xFF && i < len)
+      out[pos++] = 0;
+  }
+  return pos;
+}
+
+/// Escapes 0x0A and SERIAL_ESCAPE in `len` bytes into `out` (at least 2 * len
+/// bytes). Returns the escaped size; the output contains no 0x0A, and no zero
+/// bytes if the input has none.
+inline size_t serial_escape(const uint8_t *in, size_t len, uint8_t *out) {
+  size_t pos = 0;
+  for (size_t i = 0; i < len; i++) {
+    if (in[i] == '\n' || in[i] == SERIAL_ESCAPE) {
+      out[pos++] = SERIAL_ESCAPE;
+      out[pos++] = in[i] ^ 0x20;
+    } else {
+      out[pos++] = in[i];
+    }
+  }
+  return pos;
+}
+
+/// Reverses serial_escape() into `out` (at least `len` bytes). Returns the
+/// unescaped size, or 0 if an escape is dangling or stands for neither byte.
+inline size_t serial_unescape(const uint8_t *in, size_t len, uint8_t *out) {
+  size_t pos = 0;
+  for (size_t i = 0; i < len; i++) {
+    if (in[i] != SERIAL_ESCAPE) {
+      out[pos++] = in[i];
+      continue;
+    }
+    if (++i == len || (in[i] != ('\n' ^ 0x20) && in[i] != (SERIAL_ESCAPE ^ 0x20)))
+      return 0;
+    out[pos++] = in[i] ^ 0x20;
+  }
+  return pos;
+}
+
+/// Builds one packet and writes it to `wire` (SERIAL_MAX_WIRE bytes), ready
+/// to send. Returns the number of bytes to send.
+inline size_t build_serial_packet(SerialPacketType type, uint8_t frame_id, const uint8_t *body, size_t body_len,
+                                  uint8_t *wire) {
+  uint8_t packet[SERIAL_MAX_PACKET];
+  packet[0] = SERIAL_MAGIC_0;
+  packet[1] = SERIAL_MAGIC_1;
+  packet[2] = type;
+  packet[3] = frame_id;
+  memcpy(packet + 4, body, body_len);
+  serial_put_le32(packet + 4 + body_len, serial_crc32(packet, 4 + body_len));
+  uint8_t cobs[SERIAL_MAX_COBS];
+  size_t n = cobs_encode(packet, 4 + body_len + 4, cobs);
+  wire[0] = 0;
+  n = serial_escape(cobs, n, wire + 1);
+  wire[1 + n] = 0;
+  return n + 2;
+}
+
+/// Run-length codes RGB565 pixels. The stream is a sequence of items, each a
+/// control byte c followed by pixels (uint16 little-endian):
+///   c < 0x80   literal: c + 1 pixels follow (1..128)
+///   c >= 0x80  run: one pixel follows, repeated (c & 0x7F) + 1 times (1..128)
+/// Flat UI areas shrink to 3 bytes per 128 pixels; noise grows by 1/128.
+class Rle565Encoder {
+ public:
+  /// Worst-case encoded size of `pixels` pixels (all literals).
+  static size_t max_encoded_size(size_t pixels) { return pixels * 2 + (pixels + 127) / 128; }
+
+  /// Encodes into `out`, which must hold max_encoded_size() bytes for the frame.
+  explicit Rle565Encoder(uint8_t *out) : out_(out) {}
+
+  void push(uint16_t pixel) {
+    if (this->count_ > 0 && pixel == this->value_ && this->count_ < 128) {
+      this->count_++;
+      return;
+    }
+    this->flush_value_();
+    this->value_ = pixel;
+    this->count_ = 1;
+  }
+
+  /// Emits whatever is pending. Call once after the last pixel.
+  void finish() {
+    this->flush_value_();
+    this->flush_literals_();
+  }
+
+  size_t size() const { return this->size_; }
+
+ protected:
+  void flush_value_() {
+    if (this->count_ == 0)
+      return;
+    if (this->count_ == 1) {
+      // A lone pixel joins the pending literal item
+      this->literals_[this->literal_count_++] = this->value_;
+      if (this->literal_count_ == 128)
+        this->flush_literals_();
+    } else {
+      this->flush_literals_();
+      this->out_[this->size_++] = 0x80 | (this->count_ - 1);
+      this->put_pixel_(this->value_);
+    }
+    this->count_ = 0;
+  }
+
+  void flush_literals_() {
+    if (this->literal_count_ == 0)
+      return;
+    this->out_[this->size_++] = this->literal_count_ - 1;
+    for (int i = 0; i < this->literal_count_; i++)
+      this->put_pixel_(this->literals_[i]);
+    this->literal_count_ = 0;
+  }
+
+  void put_pixel_(uint16_t pixel) {
+    this->out_[this->size_++] = pixel & 0xFF;
+    this->out_[this->size_++] = pixel >> 8;
+  }
+
+  uint8_t *out_;
+  size_t size_{0};
+  uint16_t value_{0};      ///< Pixel being counted
+  int count_{0};           ///< Repeats of value_ so far
+  uint16_t literals_[128];  ///< Pending literal item
+  int literal_count_{0};
+};
+
+/// Decodes an RLE565 payload into exactly `pixels` pixels. Returns false if
+/// the payload is malformed or has the wrong length.
+inline bool decode_rle565(const uint8_t *data, size_t size, size_t pixels, std::vector<uint16_t> &out) {
+  out.clear();
+  out.reserve(pixels);
+  size_t i = 0;
+  while (i < size) {
+    uint8_t c = data[i++];
+    size_t n = (c & 0x7F) + 1;
+    if (out.size() + n > pixels)
+      return false;
+    if (c & 0x80) {
+      if (i + 2 > size)
+        return false;
+      out.insert(out.end(), n, serial_get_le16(data + i));
+      i += 2;
+    } else {
+      if (i + n * 2 > size)
+        return false;
+      for (size_t k = 0; k < n; k++, i += 2)
+        out.push_back(serial_get_le16(data + i));
+    }
+  }
+  return out.size() == pixels;
+}
+
+/// Splits an encoded frame into packets: one call per packet, so the sender
+/// can spread a frame over several passes of its main loop.
+class SerialFrameTransmitter {
+ public:
+  /// Starts a frame. `payload` must stay valid until next_packet() returns 0.
+  void begin(uint8_t frame_id, int width, int height, const uint8_t *payload, size_t size) {
+    this->frame_id_ = frame_id;
+    this->width_ = width;
+    this->height_ = height;
+    this->payload_ = payload;
+    this->size_ = size;
+    this->offset_ = 0;
+    this->state_ = STATE_BEGIN;
+  }
+
+  bool active() const { return this->state_ != STATE_IDLE; }
+
+  /// Writes the next packet to `wire` (SERIAL_MAX_WIRE bytes) and returns its
+  /// size, or 0 once the frame has been sent.
+  size_t next_packet(uint8_t *wire) {
+    uint8_t body[4 + SERIAL_CHUNK_SIZE];
+    switch (this->state_) {
+      case STATE_BEGIN:
+        serial_put_le16(body, this->width_);
+        serial_put_le16(body + 2, this->height_);
+        body[4] = ENCODING_RLE565;
+        serial_put_le32(body + 5, this->size_);
+        this->state_ = this->size_ > 0 ? STATE_DATA : STATE_END;
+        return build_serial_packet(PACKET_FRAME_BEGIN, this->frame_id_, body, 9, wire);
+      case STATE_DATA: {
+        size_t n = this->size_ - this->offset_;
+        if (n > SERIAL_CHUNK_SIZE)
+          n = SERIAL_CHUNK_SIZE;
+        serial_put_le32(body, this->offset_);
+        memcpy(body + 4, this->payload_ + this->offset_, n);
+        this->offset_ += n;
+        if (this->offset_ == this->size_)
+          this->state_ = STATE_END;
+        return build_serial_packet(PACKET_FRAME_DATA, this->frame_id_, body, 4 + n, wire);
+      }
+      case STATE_END:
+        serial_put_le32(body, serial_crc32(this->payload_, this->size_));
+        this->state_ = STATE_IDLE;
+        return build_serial_packet(PACKET_FRAME_END, this->frame_id_, body, 4, wire);
+      default:
+        return 0;
+    }
+  }
+
+  /// Payload bytes sent so far.
+  size_t get_offset() const { return this->offset_; }
+
+ protected:
+  enum State { STATE_IDLE, STATE_BEGIN, STATE_DATA, STATE_END };
+
+  State state_{STATE_IDLE};
+  uint8_t frame_id_{0};
+  int width_{0};
+  int height_{0};
+  const uint8_t *payload_{nullptr};
+  size_t size_{0};
+  size_t offset_{0};
+};
+
+/// Receives frames from a console byte stream. Feed it everything read from
+/// the port; console text between packets is handed back through on_text.
+class SerialFrameReceiver {
+ public:
+  /// A complete, CRC-checked frame: RGB565 pixels, top row first.
+  struct Frame {
+    int width{0};
+    int height{0};
+    std::vector<uint16_t> pixels;
+  };
+
+  void feed(const uint8_t *data, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+      if (data[i] == 0) {
+        this->end_segment_();
+      } else {
+        this->segment_.push_back(data[i]);
+        // Longer than any packet: it's console text, don't buffer it forever.
+        if (this->segment_.size() > SERIAL_MAX_WIRE + 256)
+          this->flush_text_();
+      }
+    }
+  }
+
+  /// Hands any buffered console text to on_text (e.g. when the port goes quiet).
+  void flush_text() { this->flush_text_(); }
+
+  /// Returns true and moves the frame into `out` if one has completed.
+  bool take_frame(Frame &out) {
+    if (!this->frame_ready_)
+      return false;
+    out = std::move(this->frame_);
+    this->frame_ = Frame();
+    this->frame_ready_ = false;
+    return true;
+  }
+
+  /// Called with console text found between packets.
+  std::function<void(const uint8_t *data, size_t len)> on_text;
+
+  /// Packets dropped for a bad COBS block, magic or CRC (not counting text).
+  uint32_t bad_packets{0};
+  /// Frames abandoned because of a missing or corrupt part.
+  uint32_t bad_frames{0};
+
+ protected:
+  void flush_text_() {
+    if (!this->segment_.empty() && this->on_text)
+      this->on_text(this->segment_.data(), this->segment_.size());
+    this->segment_.clear();
+  }
+
+  void end_segment_() {
+    if (this->segment_.empty())
+      return;
+    // A console that expands "\n" leaves packets alone: they contain none.
+    uint8_t cobs[SERIAL_MAX_WIRE];
+    uint8_t packet[SERIAL_MAX_WIRE];
+    size_t n = 0;
+    if (this->segment_.size() <= SERIAL_MAX_WIRE)
+      n = serial_unescape(this->segment_.data(), this->segment_.size(), cobs);
+    if (n > 0)
+      n = cobs_decode(cobs, n, packet);
+    if (n < 8 || packet[0] != SERIAL_MAGIC_0 || packet[1] != SERIAL_MAGIC_1) {
+      this->flush_text_();
+      return;
+    }
+    if (serial_crc32(packet, n - 4) != serial_get_le32(packet + n - 4)) {
+      // Looked like a packet, but damaged -- most likely interleaved output.
+      this->bad_packets++;
+      this->flush_text_();
+      return;
+    }
+    this->segment_.clear();
+    this->handle_packet_(packet[2], packet[3], packet + 4, n - 8);
+  }
+
+  void handle_packet_(uint8_t type, uint8_t frame_id, const uint8_t *body, size_t len) {
+    switch (type) {
+      case PACKET_FRAME_BEGIN:
+        if (len < 9 || body[4] != ENCODING_RLE565)
+          return;
+        if (this->receiving_)
+          this->bad_frames++;  // previous frame never ended
+        this->receiving_ = true;
+        this->frame_id_ = frame_id;
+        this->width_ = serial_get_le16(body);
+        this->height_ = serial_get_le16(body + 2);
+        this->payload_.assign(serial_get_le32(body + 5), 0);
+        this->received_ = 0;
+        return;
+      case PACKET_FRAME_DATA: {
+        if (!this->receiving_ || frame_id != this->frame_id_ || len < 4)
+          return;
+        uint32_t offset = serial_get_le32(body);
+        if (offset != this->received_ || offset + (len - 4) > this->payload_.size()) {
+          this->receiving_ = false;  // a chunk went missing
+          this->bad_frames++;
+          return;
+        }
+        memcpy(this->payload_.data() + offset, body + 4, len - 4);
+        this->received_ += len - 4;
+        return;
+      }
+      case PACKET_FRAME_END: {
+        if (!this->receiving_ || frame_id != this->frame_id_ || len < 4)
+          return;
+        this->receiving_ = false;
+        Frame frame;
+        frame.width = this->width_;
+        frame.height = this->height_;
+        if (this->received_ != this->payload_.size() ||
+            serial_crc32(this->payload_.data(), this->payload_.size()) != serial_get_le32(body) ||
+            !decode_rle565(this->payload_.data(), this->payload_.size(), (size_t) frame.width * frame.height,
+                           frame.pixels)) {
+          this->bad_frames++;
+          return;
+        }
+        this->frame_ = std::move(frame);
+        this->frame_ready_ = true;
+        return;
+      }
+      default:
+        return;
+    }
+  }
+
+  std::vector<uint8_t> segment_;  ///< Bytes since the last zero byte
+  bool receiving_{false};
+  uint8_t frame_id_{0};
+  int width_{0};
+  int height_{0};
+  std::vector<uint8_t> payload_;
+  size_t received_{0};
+  Frame frame_;
+  bool frame_ready_{false};
+};
+
+}  // namespace display_capture
+}  // namespace esphome
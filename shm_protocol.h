@@ -0,0 +1,349 @@
+// display_capture -- live framebuffer export over POSIX shared memory.
+//
+// For host (Linux) builds used for UI development. The component writes the
+// framebuffer into a shared-memory segment whenever its pixels change, and
+// local viewers, test runners and recorders map the segment and read frames
+// directly -- no HTTP, no encoding. Shared by the component (ShmFrameWriter,
+// USE_HOST builds only) and tools/shm_view.cpp (ShmFrameReader), so it is
+// header-only and uses nothing but POSIX and the C++ standard library.
+//
+// Segment layout (shm_open() name from `shared_memory:`, e.g. /dev/shm/display_capture):
+//
+//   ShmFrameHeader | padding to header_size | pixels (stride * height bytes)
+//
+// The pixels are the framebuffer as the driver keeps it: native (pre-rotation)
+// rows, top row first, in `format` and `byte_order`. `rotation` is the
+// display rotation in degrees; apply its inverse to get what is on screen
+// (see shm_screen_pixel()).
+//
+// Readers synchronise through `sequence`, a seqlock: the writer makes it odd
+// before touching anything after it in the segment and even again once the
+// frame is complete, so a frame is intact when `sequence` was even and
+// unchanged across the read. The segment only ever grows; `segment_size`
+// tells a reader when to map it again.
+
+#pragma once
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <vector>
+
+namespace esphome {
+namespace display_capture {
+
+static const uint32_t SHM_MAGIC = 0x42464344;  // "DCFB" in little-endian memory
+static const uint16_t SHM_VERSION = 1;
+/// Offset of the first pixel; room for the header to grow without moving the pixels.
+static const uint16_t SHM_HEADER_SIZE = 64;
+
+/// Values of ShmFrameHeader::format (same numbering as PixelFormat).
+enum ShmPixelFormat : uint8_t {
+  SHM_FORMAT_RGB565 = 0,
+};
+
+/// Values of ShmFrameHeader::byte_order (same numbering as ByteOrder).
+enum ShmByteOrder : uint8_t {
+  SHM_BIG_ENDIAN = 0,
+  SHM_LITTLE_ENDIAN = 1,
+};
+
+/// Geometry and pixel layout of one frame.
+struct ShmFrameLayout {
+  uint32_t width{0};   ///< Native (pre-rotation) width in pixels
+  uint32_t height{0};  ///< Native (pre-rotation) height in pixels
+  uint32_t stride{0};  ///< Bytes from one row to the next
+  uint8_t format{SHM_FORMAT_RGB565};
+  uint8_t byte_order{SHM_BIG_ENDIAN};
+  uint16_t rotation{0};  ///< Display rotation in degrees: 0, 90, 180 or 270
+
+  size_t pixel_bytes() const { return (size_t) this->stride * this->height; }
+  bool operator==(const ShmFrameLayout &o) const {
+    return this->width == o.width && this->height == o.height && this->stride == o.stride &&
+           this->format == o.format && this->byte_order == o.byte_order && this->rotation == o.rotation;
+  }
+  bool operator!=(const ShmFrameLayout &o) const { return !(*this == o); }
+};
+
+/// Start of the segment. Fixed-width fields in native byte order (readers run on the same host).
+struct ShmFrameHeader {
+  uint32_t magic;                   ///< SHM_MAGIC once the writer has initialised the segment
+  uint16_t version;                 ///< SHM_VERSION
+  uint16_t header_size;             ///< Offset of the first pixel
+  std::atomic<uint32_t> sequence;   ///< Seqlock: odd while a frame is being written
+  uint32_t segment_size;            ///< Bytes the segment currently spans
+  ShmFrameLayout layout;            ///< Layout of the frame below
+  uint64_t frame;                   ///< Frames published since the writer started
+  uint64_t timestamp_us;            ///< CLOCK_MONOTONIC time the frame was completed
+};
+
+static_assert(sizeof(ShmFrameHeader) <= SHM_HEADER_SIZE, "ShmFrameHeader outgrew SHM_HEADER_SIZE");
+static_assert(std::atomic<uint32_t>::is_always_lock_free, "seqlock needs a lock-free counter");
+
+inline uint64_t shm_monotonic_us() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/// Publishes frames into a segment. One writer per segment.
+class ShmFrameWriter {
+ public:
+  ~ShmFrameWriter() { this->close(); }
+
+  /// Creates (or takes over) the segment `name` ("/display_capture"). Returns false on error (errno set).
+  bool open(const char *name) {
+    this->close();
+    this->fd_ = shm_open(name, O_CREAT | O_RDWR, 0644);
+    if (this->fd_ < 0)
+      return false;
+    // An old segment may still be mapped by readers: only ever grow it.
+    struct stat st;
+    size_t size = fstat(this->fd_, &st) == 0 ? (size_t) st.st_size : 0;
+    if (!this->map_(size > SHM_HEADER_SIZE ? size : SHM_HEADER_SIZE)) {
+      this->close();
+      return false;
+    }
+    ShmFrameHeader *h = this->header_();
+    uint32_t seq = h->magic == SHM_MAGIC ? h->sequence.load(std::memory_order_relaxed) : 0;
+    // Keep counting from a previous run so readers never see the counter go back.
+    h->sequence.store((seq | 1) + 2, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    h->version = SHM_VERSION;
+    h->header_size = SHM_HEADER_SIZE;
+    h->segment_size = this->size_;
+    h->layout = ShmFrameLayout();
+    h->frame = 0;
+    h->timestamp_us = 0;
+    h->magic = SHM_MAGIC;
+    h->sequence.store((seq | 1) + 3, std::memory_order_release);
+    return true;
+  }
+
+  void close() {
+    if (this->base_ != nullptr)
+      munmap(this->base_, this->size_);
+    if (this->fd_ >= 0)
+      ::close(this->fd_);
+    this->base_ = nullptr;
+    this->size_ = 0;
+    this->fd_ = -1;
+  }
+
+  bool is_open() const { return this->base_ != nullptr; }
+
+  /// Layout of the frame currently in the segment.
+  const ShmFrameLayout &layout() const { return this->header_()->layout; }
+  /// Pixels currently in the segment (only the writer may read them outside a seqlock).
+  const uint8_t *pixels() const { return this->base_ + SHM_HEADER_SIZE; }
+
+  /// Starts a frame with `layout`, growing the segment if needed, and returns
+  /// where its pixels go. Readers see no frame until end_frame(). Returns
+  /// nullptr if the segment can't grow (the previous frame stays readable).
+  uint8_t *begin_frame(const ShmFrameLayout &layout) {
+    size_t needed = SHM_HEADER_SIZE + layout.pixel_bytes();
+    if (needed > this->size_ && !this->map_(needed))
+      return nullptr;
+    ShmFrameHeader *h = this->header_();
+    h->sequence.store(h->sequence.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    h->segment_size = this->size_;
+    h->layout = layout;
+    return this->base_ + SHM_HEADER_SIZE;
+  }
+
+  /// Completes the frame started by begin_frame().
+  void end_frame() {
+    ShmFrameHeader *h = this->header_();
+    h->frame++;
+    h->timestamp_us = shm_monotonic_us();
+    h->sequence.store(h->sequence.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+  }
+
+  /// Publishes the frame at `src` (rows `src_stride` bytes apart) unless it
+  /// has the layout and pixels of the frame already in the segment, so an
+  /// unchanged screen costs one memcmp per row. Returns true if it published.
+  bool publish_if_changed(const ShmFrameLayout &layout, const uint8_t *src, size_t src_stride) {
+    bool changed = layout != this->layout();
+    for (uint32_t y = 0; y < layout.height && !changed; y++)
+      changed = memcmp(src + y * src_stride, this->pixels() + y * layout.stride, layout.stride) != 0;
+    if (!changed)
+      return false;
+    uint8_t *dst = this->begin_frame(layout);
+    if (dst == nullptr)
+      return false;
+    for (uint32_t y = 0; y < layout.height; y++)
+      memcpy(dst + y * layout.stride, src + y * src_stride, layout.stride);
+    this->end_frame();
+    return true;
+  }
+
+ protected:
+  ShmFrameHeader *header_() const { return reinterpret_cast<ShmFrameHeader *>(this->base_); }
+
+  /// Sizes the segment to at least `size` bytes and maps all of it.
+  bool map_(size_t size) {
+    size = (size + 4095) & ~(size_t) 4095;
+    if (ftruncate(this->fd_, size) != 0)
+      return false;
+    void *base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, this->fd_, 0);
+    if (base == MAP_FAILED)
+      return false;
+    if (this->base_ != nullptr)
+      munmap(this->base_, this->size_);
+    this->base_ = static_cast<uint8_t *>(base);
+    this->size_ = size;
+    return true;
+  }
+
+  int fd_{-1};
+  uint8_t *base_{nullptr};
+  size_t size_{0};
+};
+
+/// Reads frames from a segment written by ShmFrameWriter.
+class ShmFrameReader {
+ public:
+  /// One intact frame.
+  struct Frame {
+    ShmFrameLayout layout;
+    uint64_t frame{0};         ///< Frame number (counts from 1 per writer run)
+    uint64_t timestamp_us{0};  ///< CLOCK_MONOTONIC time it was completed
+    std::vector<uint8_t> pixels;
+  };
+
+  ~ShmFrameReader() { this->close(); }
+
+  /// Opens the segment `name` read-only. Returns false if it doesn't exist (yet).
+  bool open(const char *name) {
+    this->close();
+    this->fd_ = shm_open(name, O_RDONLY, 0);
+    if (this->fd_ < 0)
+      return false;
+    if (!this->map_()) {
+      this->close();
+      return false;
+    }
+    return true;
+  }
+
+  void close() {
+    if (this->base_ != nullptr)
+      munmap(const_cast<uint8_t *>(this->base_), this->size_);
+    if (this->fd_ >= 0)
+      ::close(this->fd_);
+    this->base_ = nullptr;
+    this->size_ = 0;
+    this->fd_ = -1;
+  }
+
+  /// Current seqlock value: cheap to poll, changes whenever a frame is published.
+  uint32_t sequence() const { return this->header_()->sequence.load(std::memory_order_acquire); }
+
+  /// Copies the latest intact frame into `out`. Returns false if nothing has
+  /// been published yet, or if the writer kept the segment busy for `attempts` tries.
+  bool read(Frame &out, int attempts = 1000) {
+    for (int i = 0; i < attempts; i++) {
+      const ShmFrameHeader *h = this->header_();
+      uint32_t seq = h->sequence.load(std::memory_order_acquire);
+      if (seq & 1)
+        continue;  // mid-write
+      if (h->magic != SHM_MAGIC || h->version != SHM_VERSION)
+        return false;
+      if (h->segment_size > this->size_) {
+        if (!this->map_())
+          return false;
+        continue;
+      }
+      ShmFrameLayout layout = h->layout;
+      uint64_t frame = h->frame;
+      uint64_t timestamp_us = h->timestamp_us;
+      size_t offset = h->header_size;
+      size_t bytes = layout.pixel_bytes();
+      if (frame == 0 || offset + bytes > this->size_) {
+        if (this->stable_(seq))
+          return false;  // consistent, but nothing published
+        continue;
+      }
+      out.pixels.resize(bytes);
+      memcpy(out.pixels.data(), this->base_ + offset, bytes);
+      if (!this->stable_(seq))
+        continue;  // torn -- the writer got in
+      out.layout = layout;
+      out.frame = frame;
+      out.timestamp_us = timestamp_us;
+      return true;
+    }
+    return false;
+  }
+
+ protected:
+  const ShmFrameHeader *header_() const { return reinterpret_cast<const ShmFrameHeader *>(this->base_); }
+
+  /// True if nothing was written since `seq` was loaded.
+  bool stable_(uint32_t seq) const {
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return this->header_()->sequence.load(std::memory_order_relaxed) == seq;
+  }
+
+  bool map_() {
+    struct stat st;
+    if (fstat(this->fd_, &st) != 0 || (size_t) st.st_size < SHM_HEADER_SIZE)
+      return false;
+    void *base = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, this->fd_, 0);
+    if (base == MAP_FAILED)
+      return false;
+    if (this->base_ != nullptr)
+      munmap(const_cast<uint8_t *>(this->base_), this->size_);
+    this->base_ = static_cast<const uint8_t *>(base);
+    this->size_ = st.st_size;
+    return true;
+  }
+
+  int fd_{-1};
+  const uint8_t *base_{nullptr};
+  size_t size_{0};
+};
+
+/// Screen size of a frame (rotation applied).
+inline void shm_screen_size(const ShmFrameLayout &layout, int &width, int &height) {
+  bool swap = layout.rotation == 90 || layout.rotation == 270;
+  width = swap ? layout.height : layout.width;
+  height = swap ? layout.width : layout.height;
+}
+
+/// RGB565 value of the pixel at screen coordinates (sx, sy). Inverts the
+/// rotation draw_pixel_at() applies, as the component's capture does.
+inline uint16_t shm_screen_pixel(const ShmFrameLayout &layout, const uint8_t *pixels, int sx, int sy) {
+  int w = layout.width;
+  int h = layout.height;
+  int bx = sx, by = sy;
+  switch (layout.rotation) {
+    case 90:
+      bx = w - 1 - sy;
+      by = sx;
+      break;
+    case 180:
+      bx = w - 1 - sx;
+      by = h - 1 - sy;
+      break;
+    case 270:
+      bx = sy;
+      by = h - 1 - sx;
+      break;
+    default:
+      break;
+  }
+  const uint8_t *p = pixels + (size_t) by * layout.stride + (size_t) bx * 2;
+  return layout.byte_order == SHM_BIG_ENDIAN ? (p[0] << 8 | p[1]) : (p[1] << 8 | p[0]);
+}
+
+}  // namespace display_capture
+}  // namespace esphome
@@ -0,0 +1,129 @@
+// image_io -- BMP decoding and PNG encoding for the host-side tools.
+//
+// Header-only so each tool stays a single g++ command. PNG output needs
+// zlib (-lz). Only the formats display_capture produces are decoded:
+// uncompressed 24-bit BMPs, bottom-up or top-down.
+
+#pragma once
+
+#include <zlib.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace image_io {
+
+/// Decoded image: tightly packed RGB888, top row first.
+struct Image {
+  int width{0};
+  int height{0};
+  std::vector<uint8_t> rgb;
+};
+
+inline uint32_t read_le32(const uint8_t *p) { return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24); }
+inline uint16_t read_le16(const uint8_t *p) { return p[0] | (p[1] << 8); }
+
+/// Decodes a 24-bit uncompressed BMP. Returns false (with `err` set) on anything else.
+inline bool decode_bmp(const uint8_t *data, size_t size, Image &out, std::string &err) {
+  if (size < 54 || data[0] != 'B' || data[1] != 'M') {
+    err = "not a BMP";
+    return false;
+  }
+  uint32_t offset = read_le32(data + 10);
+  int32_t width = (int32_t) read_le32(data + 18);
+  int32_t height = (int32_t) read_le32(data + 22);
+  uint16_t bpp = read_le16(data + 28);
+  uint32_t compression = read_le32(data + 30);
+  if (bpp != 24 || compression != 0) {
+    err = "unsupported BMP (bpp " + std::to_string(bpp) + ", compression " + std::to_string(compression) + ")";
+    return false;
+  }
+  bool bottom_up = height > 0;
+  if (!bottom_up)
+    height = -height;
+  if (width <= 0 || height <= 0) {
+    err = "bad BMP dimensions";
+    return false;
+  }
+  size_t row_stride = ((size_t) width * 3 + 3) / 4 * 4;
+  if (offset + row_stride * height > size) {
+    err = "truncated BMP";
+    return false;
+  }
+
+  out.width = width;
+  out.height = height;
+  out.rgb.resize((size_t) width * height * 3);
+  for (int y = 0; y < height; y++) {
+    const uint8_t *src = data + offset + row_stride * (bottom_up ? height - 1 - y : y);
+    uint8_t *dst = out.rgb.data() + (size_t) y * width * 3;
+    for (int x = 0; x < width; x++) {
+      dst[x * 3 + 0] = src[x * 3 + 2];
+      dst[x * 3 + 1] = src[x * 3 + 1];
+      dst[x * 3 + 2] = src[x * 3 + 0];
+    }
+  }
+  return true;
+}
+
+inline void png_put_be32(std::vector<uint8_t> &v, uint32_t x) {
+  v.push_back(x >> 24);
+  v.push_back(x >> 16);
+  v.push_back(x >> 8);
+  v.push_back(x);
+}
+
+inline void png_chunk(std::vector<uint8_t> &png, const char *type, const uint8_t *data, size_t len) {
+  png_put_be32(png, len);
+  size_t start = png.size();
+  png.insert(png.end(), type, type + 4);
+  png.insert(png.end(), data, data + len);
+  png_put_be32(png, crc32(0, png.data() + start, len + 4));
+}
+
+/// Encodes an RGB888 image as PNG (colour type 2, Sub filter on every row --
+/// display UIs are mostly flat horizontal runs, which Sub turns into zeros).
+inline bool encode_png(const Image &img, std::vector<uint8_t> &png, std::string &err) {
+  size_t row = (size_t) img.width * 3;
+  std::vector<uint8_t> raw((row + 1) * img.height);
+  for (int y = 0; y < img.height; y++) {
+    const uint8_t *src = img.rgb.data() + y * row;
+    uint8_t *dst = raw.data() + y * (row + 1);
+    dst[0] = 1;  // Sub
+    for (size_t i = 0; i < row; i++)
+      dst[1 + i] = src[i] - (i >= 3 ? src[i - 3] : 0);
+  }
+
+  uLongf zlen = compressBound(raw.size());
+  std::vector<uint8_t> z(zlen);
+  if (compress2(z.data(), &zlen, raw.data(), raw.size(), 6) != Z_OK) {
+    err = "zlib compression failed";
+    return false;
+  }
+
+  static const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+  png.assign(signature, signature + 8);
+  std::vector<uint8_t> ihdr;
+  png_put_be32(ihdr, img.width);
+  png_put_be32(ihdr, img.height);
+  ihdr.insert(ihdr.end(), {8, 2, 0, 0, 0});  // 8-bit, RGB, deflate, no filter method, no interlace
+  png_chunk(png, "IHDR", ihdr.data(), ihdr.size());
+  png_chunk(png, "IDAT", z.data(), zlen);
+  png_chunk(png, "IEND", nullptr, 0);
+  return true;
+}
+
+/// Writes `data` to `path`, replacing it atomically via a temporary file.
+inline bool write_file(const std::string &path, const std::vector<uint8_t> &data) {
+  std::string tmp = path + ".tmp";
+  FILE *f = fopen(tmp.c_str(), "wb");
+  if (f == nullptr)
+    return false;
+  bool ok = fwrite(data.data(), 1, data.size(), f) == data.size();
+  ok = fclose(f) == 0 && ok;
+  return ok && rename(tmp.c_str(), path.c_str()) == 0;
+}
+
+}  // namespace image_io
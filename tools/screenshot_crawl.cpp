@@ -0,0 +1,833 @@
+// screenshot_crawl -- fetch every page of every display_capture device.
+//
+// Replaces the README's serial `for p in ...; do curl ...` loop for fleets:
+//
+//   - Discovers pages from GET /screenshot/info on each device
+//   - One connection at a time per device (the device serializes captures
+//     anyway), all devices in parallel -- a full crawl takes about as long as
+//     the slowest single device
+//   - Sends If-None-Match with the ETag from the previous crawl; pages that
+//     answer 304 are skipped without a download
+//   - Sends Cache-Control: no-cache, so a busy device captures the page now
+//     instead of answering with its previous frame
+//   - Decodes BMP and encodes PNG on a thread pool, so conversion overlaps
+//     with the next download
+//   - Reads each response up to its Content-Length, so a device that keeps
+//     the connection open doesn't stall the crawl; short bodies are errors
+//   - Writes <out>/manifest.json describing every device and page
+//
+// Build (Linux / macOS, needs zlib):
+//   g++ -std=c++17 -O2 -pthread -o screenshot_crawl tools/screenshot_crawl.cpp -lz
+//
+// Usage:
+//   screenshot_crawl [-o DIR] [-j THREADS] [-t TIMEOUT_S] [-f FILE] [HOST[:PORT] ...]
+//   screenshot_crawl --self-test
+//
+// --self-test crawls fake devices on 127.0.0.1 twice and checks the
+// downloads, the 304s and saved ETags of the second crawl, the
+// current-screen fallback and the rejection of a truncated body.
+//
+// Output layout:
+//   DIR/manifest.json
+//   DIR/<host>/page<N>.png
+//   DIR/<host>/etags.tsv       -- ETags for conditional requests next time
+
+#include "image_io.h"
+
+#include <arpa/inet.h>
+#include <ftw.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <sstream>
+#include <thread>
+
+namespace {
+
+// ============================================================================
+// Minimal HTTP/1.1 client -- GET only, one request per connection
+// ============================================================================
+
+struct HttpResponse {
+  int status{0};
+  std::map<std::string, std::string> headers;  ///< Lower-cased names
+  std::string body;
+};
+
+std::string to_lower(std::string s) {
+  std::transform(s.begin(), s.end(), s.begin(), [](unsigned char c) { return std::tolower(c); });
+  return s;
+}
+
+/// Decodes a Transfer-Encoding: chunked body in place. Returns false if malformed.
+bool dechunk(std::string &body) {
+  std::string out;
+  size_t pos = 0;
+  while (true) {
+    size_t eol = body.find("\r\n", pos);
+    if (eol == std::string::npos)
+      return false;
+    size_t len = strtoul(body.c_str() + pos, nullptr, 16);
+    pos = eol + 2;
+    if (len == 0)
+      break;
+    if (pos + len > body.size())
+      return false;
+    out.append(body, pos, len);
+    pos += len + 2;
+  }
+  body.swap(out);
+  return true;
+}
+
+/// Appends whatever the socket has next to `data`. Returns false at EOF
+/// (`err` empty) or on an error or timeout (`err` set).
+bool recv_some(int fd, std::string &data, std::string &err) {
+  char buf[16384];
+  ssize_t n = recv(fd, buf, sizeof(buf), 0);
+  if (n < 0) {
+    err = "recv: " + std::string(strerror(errno));
+    return false;
+  }
+  data.append(buf, n);
+  return n > 0;
+}
+
+bool http_get(const std::string &host, const std::string &port, const std::string &path,
+              const std::vector<std::string> &extra_headers, int timeout_s, HttpResponse &resp, std::string &err) {
+  addrinfo hints{};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo *res = nullptr;
+  int rc = getaddrinfo(host.c_str(), port.c_str(), &hints, &res);
+  if (rc != 0) {
+    err = std::string("resolve: ") + gai_strerror(rc);
+    return false;
+  }
+
+  int fd = -1;
+  for (addrinfo *ai = res; ai != nullptr; ai = ai->ai_next) {
+    fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    if (fd < 0)
+      continue;
+    timeval tv{timeout_s, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0)
+      break;
+    close(fd);
+    fd = -1;
+  }
+  freeaddrinfo(res);
+  if (fd < 0) {
+    err = "connect: " + std::string(strerror(errno));
+    return false;
+  }
+
+  std::string req = "GET " + path + " HTTP/1.1\r\nHost: " + host + "\r\nConnection: close\r\n";
+  for (const auto &h : extra_headers)
+    req += h + "\r\n";
+  req += "\r\n";
+  if (send(fd, req.data(), req.size(), 0) != (ssize_t) req.size()) {
+    err = "send: " + std::string(strerror(errno));
+    close(fd);
+    return false;
+  }
+
+  // Headers first: with Content-Length known, the body ends after that many
+  // bytes even if the server keeps the connection open.
+  std::string raw;
+  size_t header_end;
+  while ((header_end = raw.find("\r\n\r\n")) == std::string::npos) {
+    if (!recv_some(fd, raw, err)) {
+      if (err.empty())
+        err = "connection closed before the headers";
+      close(fd);
+      return false;
+    }
+  }
+  if (raw.compare(0, 5, "HTTP/") != 0) {
+    err = "malformed HTTP response";
+    close(fd);
+    return false;
+  }
+  std::istringstream lines(raw.substr(0, header_end));
+  std::string line;
+  std::getline(lines, line);
+  resp.status = atoi(line.c_str() + line.find(' ') + 1);
+  while (std::getline(lines, line)) {
+    if (!line.empty() && line.back() == '\r')
+      line.pop_back();
+    size_t colon = line.find(':');
+    if (colon == std::string::npos)
+      continue;
+    size_t value = line.find_first_not_of(' ', colon + 1);
+    resp.headers[to_lower(line.substr(0, colon))] = value == std::string::npos ? "" : line.substr(value);
+  }
+  resp.body = raw.substr(header_end + 4);
+
+  bool chunked = to_lower(resp.headers["transfer-encoding"]) == "chunked";
+  auto length = resp.headers.find("content-length");
+  if (resp.status == 304 || resp.status == 204 || resp.status / 100 == 1) {
+    resp.body.clear();  // never has a body
+  } else if (!chunked && length != resp.headers.end()) {
+    size_t expected = strtoul(length->second.c_str(), nullptr, 10);
+    while (resp.body.size() < expected && recv_some(fd, resp.body, err)) {
+    }
+    if (resp.body.size() < expected) {
+      // A truncated BMP would decode into garbage (or not at all): reject it.
+      err = (err.empty() ? "body truncated" : err) + " after " + std::to_string(resp.body.size()) + " of " +
+            std::to_string(expected) + " bytes";
+      close(fd);
+      return false;
+    }
+    resp.body.resize(expected);
+  } else {
+    // No length: the body ends when the server closes the connection.
+    while (recv_some(fd, resp.body, err)) {
+    }
+    if (!err.empty()) {
+      close(fd);
+      return false;
+    }
+  }
+  close(fd);
+  if (chunked && !dechunk(resp.body)) {
+    err = "malformed chunked body";
+    return false;
+  }
+  return true;
+}
+
+// ============================================================================
+// Just enough JSON for /screenshot/info and the manifest
+// ============================================================================
+
+/// Returns the integer value of "key", or `fallback` if absent.
+long json_int(const std::string &json, const std::string &key, long fallback) {
+  size_t pos = json.find("\"" + key + "\":");
+  if (pos == std::string::npos)
+    return fallback;
+  return strtol(json.c_str() + pos + key.size() + 3, nullptr, 10);
+}
+
+/// Parses a JSON string starting at the opening quote; advances `pos` past it.
+std::string json_parse_string(const std::string &json, size_t &pos) {
+  std::string out;
+  for (pos++; pos < json.size() && json[pos] != '"'; pos++) {
+    char c = json[pos];
+    if (c == '\\' && pos + 1 < json.size()) {
+      c = json[++pos];
+      switch (c) {
+        case 'n': out += '\n'; break;
+        case 'r': out += '\r'; break;
+        case 't': out += '\t'; break;
+        case 'b': out += '\b'; break;
+        case 'f': out += '\f'; break;
+        case 'u':
+          // Only control characters are \u-escaped by the device
+          out += (char) strtol(json.substr(pos + 1, 4).c_str(), nullptr, 16);
+          pos += 4;
+          break;
+        default: out += c; break;
+      }
+    } else {
+      out += c;
+    }
+  }
+  pos++;
+  return out;
+}
+
+std::string json_string(const std::string &json, const std::string &key) {
+  size_t pos = json.find("\"" + key + "\":\"");
+  if (pos == std::string::npos)
+    return "";
+  pos += key.size() + 3;
+  return json_parse_string(json, pos);
+}
+
+std::vector<std::string> json_string_array(const std::string &json, const std::string &key) {
+  std::vector<std::string> out;
+  size_t pos = json.find("\"" + key + "\":[");
+  if (pos == std::string::npos)
+    return out;
+  pos += key.size() + 4;
+  while (pos < json.size() && json[pos] != ']') {
+    if (json[pos] == '"')
+      out.push_back(json_parse_string(json, pos));
+    else
+      pos++;
+  }
+  return out;
+}
+
+std::string json_escape(const std::string &s) {
+  std::string out;
+  for (char c : s) {
+    switch (c) {
+      case '"': out += "\\\""; break;
+      case '\\': out += "\\\\"; break;
+      case '\n': out += "\\n"; break;
+      default:
+        if (static_cast<unsigned char>(c) < 0x20) {
+          char buf[8];
+          snprintf(buf, sizeof(buf), "\\u%04x", static_cast<unsigned char>(c));
+          out += buf;
+        } else {
+          out += c;
+        }
+        break;
+    }
+  }
+  return out;
+}
+
+// ============================================================================
+// Thread pool for BMP -> PNG conversion
+// ============================================================================
+
+class ThreadPool {
+ public:
+  explicit ThreadPool(unsigned threads) {
+    for (unsigned i = 0; i < threads; i++)
+      this->workers_.emplace_back([this] { this->run_(); });
+  }
+
+  ~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(this->mutex_);
+      this->stopping_ = true;
+    }
+    this->cv_.notify_all();
+    for (auto &t : this->workers_)
+      t.join();
+  }
+
+  void submit(std::function<void()> job) {
+    {
+      std::lock_guard<std::mutex> lock(this->mutex_);
+      this->jobs_.push(std::move(job));
+    }
+    this->cv_.notify_one();
+  }
+
+ protected:
+  void run_() {
+    while (true) {
+      std::function<void()> job;
+      {
+        std::unique_lock<std::mutex> lock(this->mutex_);
+        this->cv_.wait(lock, [this] { return this->stopping_ || !this->jobs_.empty(); });
+        if (this->jobs_.empty())
+          return;  // stopping and drained
+        job = std::move(this->jobs_.front());
+        this->jobs_.pop();
+      }
+      job();
+    }
+  }
+
+  std::vector<std::thread> workers_;
+  std::queue<std::function<void()>> jobs_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  bool stopping_{false};
+};
+
+// ============================================================================
+// Crawl state
+// ============================================================================
+
+struct PageResult {
+  int page{0};
+  std::string name;
+  std::string file;    ///< Relative to the output directory
+  std::string etag;
+  std::string status;  ///< "changed", "unchanged" or "error"
+  std::string error;
+  size_t bytes{0};     ///< Bytes downloaded (0 for 304)
+};
+
+struct DeviceResult {
+  std::string host;
+  std::string dir;  ///< Directory name under the output directory
+  int width{0};
+  int height{0};
+  std::string mode;
+  std::string error;
+  long elapsed_ms{0};
+  std::vector<PageResult> pages;
+};
+
+struct Options {
+  std::string out_dir{"screenshots"};
+  unsigned threads{std::max(1u, std::thread::hardware_concurrency())};
+  int timeout_s{15};
+  std::vector<std::string> hosts;
+};
+
+/// Filesystem-safe directory name for a host ("10.0.0.5:8080" -> "10.0.0.5_8080").
+std::string host_dir(const std::string &host) {
+  std::string out = host;
+  for (char &c : out) {
+    if (!isalnum((unsigned char) c) && c != '.' && c != '-')
+      c = '_';
+  }
+  return out;
+}
+
+std::map<int, std::string> load_etags(const std::string &path) {
+  std::map<int, std::string> etags;
+  std::ifstream in(path);
+  std::string line;
+  while (std::getline(in, line)) {
+    size_t tab = line.find('\t');
+    if (tab != std::string::npos)
+      etags[atoi(line.c_str())] = line.substr(tab + 1);
+  }
+  return etags;
+}
+
+bool file_exists(const std::string &path) {
+  struct stat st;
+  return stat(path.c_str(), &st) == 0;
+}
+
+long ms_since(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+/// Crawls one device: serially fetches every page, hands changed BMPs to the
+/// pool for PNG conversion. Page results are filled in by the pool workers,
+/// so `result` must outlive the pool's pending jobs.
+void crawl_device(const Options &opts, ThreadPool &pool, DeviceResult &result) {
+  auto start = std::chrono::steady_clock::now();
+  std::string host = result.host;
+  std::string port = "80";
+  size_t colon = host.rfind(':');
+  if (colon != std::string::npos) {
+    port = host.substr(colon + 1);
+    host = host.substr(0, colon);
+  }
+
+  std::string dir = opts.out_dir + "/" + result.dir;
+  mkdir(dir.c_str(), 0755);
+
+  HttpResponse info;
+  std::string err;
+  if (!http_get(host, port, "/screenshot/info", {}, opts.timeout_s, info, err) || info.status != 200) {
+    result.error = err.empty() ? "info: HTTP " + std::to_string(info.status) : "info: " + err;
+    result.elapsed_ms = ms_since(start);
+    return;
+  }
+  result.width = json_int(info.body, "width", 0);
+  result.height = json_int(info.body, "height", 0);
+  result.mode = json_string(info.body, "mode");
+  std::vector<std::string> names = json_string_array(info.body, "page_names");
+  // "pages" is omitted when the device doesn't know (global pages without
+  // page_names) -- fall back to the names, then to the current screen only,
+  // fetched without page= since there is no page number to ask for.
+  bool has_count = info.body.find("\"pages\":") != std::string::npos;
+  int page_count = json_int(info.body, "pages", names.empty() ? 1 : (long) names.size());
+  bool current_screen = result.mode == "single" || (!has_count && names.empty());
+
+  std::map<int, std::string> etags = load_etags(dir + "/etags.tsv");
+  result.pages.resize(page_count);
+
+  for (int p = 0; p < page_count; p++) {
+    PageResult &page = result.pages[p];
+    page.page = p;
+    page.name = p < (int) names.size() ? names[p] : "";
+    page.file = result.dir + "/page" + std::to_string(p) + ".png";
+    std::string png_path = opts.out_dir + "/" + page.file;
+
+    // Always the current screen: a stale frame would leave this crawl one behind.
+    std::vector<std::string> headers = {"Cache-Control: no-cache"};
+    auto it = etags.find(p);
+    if (it != etags.end() && file_exists(png_path))
+      headers.push_back("If-None-Match: " + it->second);
+
+    std::string path = current_screen ? "/screenshot" : "/screenshot?page=" + std::to_string(p);
+    HttpResponse resp;
+    if (!http_get(host, port, path, headers, opts.timeout_s, resp, err)) {
+      page.status = "error";
+      page.error = err;
+      continue;
+    }
+    page.etag = resp.headers["etag"];
+    if (resp.status == 304) {
+      page.status = "unchanged";
+      if (page.etag.empty() && it != etags.end())
+        page.etag = it->second;
+      continue;
+    }
+    if (resp.status != 200) {
+      page.status = "error";
+      page.error = "HTTP " + std::to_string(resp.status);
+      continue;
+    }
+
+    page.bytes = resp.body.size();
+    auto body = std::make_shared<std::string>(std::move(resp.body));
+    pool.submit([body, &page, png_path] {
+      image_io::Image img;
+      std::vector<uint8_t> png;
+      std::string err;
+      if (!image_io::decode_bmp((const uint8_t *) body->data(), body->size(), img, err) ||
+          !image_io::encode_png(img, png, err)) {
+        page.status = "error";
+        page.error = err;
+        return;
+      }
+      if (!image_io::write_file(png_path, png)) {
+        page.status = "error";
+        page.error = "write " + png_path + ": " + strerror(errno);
+        return;
+      }
+      page.status = "changed";
+    });
+  }
+  result.elapsed_ms = ms_since(start);
+}
+
+void write_etags(const std::string &out_dir, const DeviceResult &device) {
+  std::ofstream out(out_dir + "/" + device.dir + "/etags.tsv");
+  for (const auto &page : device.pages) {
+    // Only remember ETags for pages we actually have on disk
+    if (page.status != "error" && !page.etag.empty())
+      out << page.page << "\t" << page.etag << "\n";
+  }
+}
+
+bool write_manifest(const Options &opts, const std::vector<DeviceResult> &devices, long elapsed_ms) {
+  char stamp[32];
+  time_t now = time(nullptr);
+  strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+
+  std::string json = "{\n  \"generated\": \"" + std::string(stamp) + "\",\n";
+  json += "  \"elapsed_ms\": " + std::to_string(elapsed_ms) + ",\n  \"devices\": [";
+  for (size_t d = 0; d < devices.size(); d++) {
+    const DeviceResult &dev = devices[d];
+    json += d > 0 ? ",\n    {" : "\n    {";
+    json += "\"host\": \"" + json_escape(dev.host) + "\"";
+    json += ", \"width\": " + std::to_string(dev.width) + ", \"height\": " + std::to_string(dev.height);
+    json += ", \"mode\": \"" + json_escape(dev.mode) + "\"";
+    json += ", \"elapsed_ms\": " + std::to_string(dev.elapsed_ms);
+    if (!dev.error.empty())
+      json += ", \"error\": \"" + json_escape(dev.error) + "\"";
+    json += ", \"pages\": [";
+    for (size_t p = 0; p < dev.pages.size(); p++) {
+      const PageResult &page = dev.pages[p];
+      json += p > 0 ? ",\n      {" : "\n      {";
+      json += "\"page\": " + std::to_string(page.page);
+      json += ", \"name\": \"" + json_escape(page.name) + "\"";
+      json += ", \"file\": \"" + json_escape(page.file) + "\"";
+      json += ", \"etag\": \"" + json_escape(page.etag) + "\"";
+      json += ", \"status\": \"" + page.status + "\"";
+      json += ", \"bytes\": " + std::to_string(page.bytes);
+      if (!page.error.empty())
+        json += ", \"error\": \"" + json_escape(page.error) + "\"";
+      json += "}";
+    }
+    json += dev.pages.empty() ? "]}" : "\n    ]}";
+  }
+  json += "\n  ]\n}\n";
+  return image_io::write_file(opts.out_dir + "/manifest.json", std::vector<uint8_t>(json.begin(), json.end()));
+}
+
+/// Crawls every host in `opts` in parallel and records the new ETags.
+std::vector<DeviceResult> crawl_all(const Options &opts) {
+  mkdir(opts.out_dir.c_str(), 0755);
+  std::vector<DeviceResult> devices(opts.hosts.size());
+  {
+    ThreadPool pool(opts.threads);
+    std::vector<std::thread> crawlers;
+    for (size_t i = 0; i < opts.hosts.size(); i++) {
+      devices[i].host = opts.hosts[i];
+      devices[i].dir = host_dir(opts.hosts[i]);
+      crawlers.emplace_back(crawl_device, std::cref(opts), std::ref(pool), std::ref(devices[i]));
+    }
+    for (auto &t : crawlers)
+      t.join();
+    // Pool destructor drains the remaining conversions
+  }
+  for (const auto &dev : devices)
+    write_etags(opts.out_dir, dev);
+  return devices;
+}
+
+// ============================================================================
+// Self-test -- fake devices on loopback
+// ============================================================================
+
+/// A display_capture stand-in on 127.0.0.1. Like the ESP-IDF httpd it keeps
+/// every connection open after answering, so a client that waits for EOF
+/// instead of honouring Content-Length stalls until its timeout.
+class FakeDevice {
+ public:
+  /// `info` is the /screenshot/info body; `truncate` cuts every BMP short.
+  FakeDevice(std::string info, bool truncate) : info_(std::move(info)), truncate_(truncate) {
+    this->fd_ = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    if (this->fd_ < 0 || bind(this->fd_, (sockaddr *) &addr, sizeof(addr)) != 0 || listen(this->fd_, 4) != 0 ||
+        getsockname(this->fd_, (sockaddr *) &addr, &len) != 0)
+      return;
+    this->host_ = "127.0.0.1:" + std::to_string(ntohs(addr.sin_port));
+    this->thread_ = std::thread([this] { this->serve_(); });
+  }
+  ~FakeDevice() {
+    shutdown(this->fd_, SHUT_RDWR);  // wakes accept()
+    if (this->thread_.joinable())
+      this->thread_.join();
+    close(this->fd_);
+  }
+
+  /// HOST:PORT to crawl; empty if the socket couldn't be set up.
+  const std::string &host() const { return this->host_; }
+  /// Request lines seen so far ("GET /screenshot?page=0"), with
+  /// " (If-None-Match)" appended when the request was conditional.
+  std::vector<std::string> requests() {
+    std::lock_guard<std::mutex> lock(this->mutex_);
+    return this->requests_;
+  }
+
+  static std::string etag() { return "\"00c0ffee\""; }
+
+  /// A 2x2 24-bit BMP.
+  static std::string bmp() {
+    std::string bmp(54 + 2 * 8, '\0');
+    auto put32 = [&bmp](size_t at, uint32_t v) {
+      for (int i = 0; i < 4; i++)
+        bmp[at + i] = (char) (v >> (8 * i));
+    };
+    bmp[0] = 'B';
+    bmp[1] = 'M';
+    put32(2, bmp.size());
+    put32(10, 54);
+    put32(14, 40);
+    put32(18, 2);
+    put32(22, 2);
+    bmp[26] = 1;
+    bmp[28] = 24;
+    for (size_t i = 54; i < bmp.size(); i++)
+      bmp[i] = (char) (i * 37);
+    return bmp;
+  }
+
+ protected:
+  void serve_() {
+    int conn;
+    while ((conn = accept(this->fd_, nullptr, nullptr)) >= 0) {
+      timeval tv{5, 0};
+      setsockopt(conn, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+      std::string request, err;
+      while (request.find("\r\n\r\n") == std::string::npos && recv_some(conn, request, err)) {
+      }
+      std::string line = request.substr(0, request.find(" HTTP/"));
+      bool conditional = to_lower(request).find("if-none-match: " + etag()) != std::string::npos;
+      {
+        std::lock_guard<std::mutex> lock(this->mutex_);
+        this->requests_.push_back(line + (conditional ? " (If-None-Match)" : ""));
+      }
+
+      std::string head, body;
+      if (line == "GET /screenshot/info") {
+        head = "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\n";
+        body = this->info_;
+      } else if (conditional) {
+        head = "HTTP/1.1 304 Not Modified\r\nETag: " + etag() + "\r\n";
+      } else {
+        head = "HTTP/1.1 200 OK\r\nContent-Type: image/bmp\r\nETag: " + etag() + "\r\n";
+        body = bmp();
+      }
+      if (!body.empty())
+        head += "Content-Length: " + std::to_string(body.size()) + "\r\n";
+      std::string out = head + "\r\n" + (this->truncate_ && line != "GET /screenshot/info" ? body.substr(0, 40) : body);
+      send(conn, out.data(), out.size(), MSG_NOSIGNAL);
+      // Keep-alive: hold the connection until the client hangs up, unless
+      // the response is truncated, which only shows up at EOF.
+      if (!this->truncate_) {
+        while (recv_some(conn, request, err)) {
+        }
+      }
+      close(conn);
+    }
+  }
+
+  std::string info_;
+  bool truncate_;
+  int fd_{-1};
+  std::string host_;
+  std::thread thread_;
+  std::mutex mutex_;
+  std::vector<std::string> requests_;
+};
+
+int self_test() {
+  char dir_template[] = "/tmp/screenshot_crawl.XXXXXX";
+  if (mkdtemp(dir_template) == nullptr) {
+    fprintf(stderr, "self-test: mkdtemp: %s\n", strerror(errno));
+    return 1;
+  }
+  FakeDevice paged("{\"pages\":2,\"width\":2,\"height\":2,\"mode\":\"native_pages\"}", false);
+  FakeDevice global("{\"width\":2,\"height\":2,\"mode\":\"global_pages\"}", false);
+  FakeDevice truncated("{\"pages\":1,\"width\":2,\"height\":2,\"mode\":\"native_pages\"}", true);
+  if (paged.host().empty() || global.host().empty() || truncated.host().empty()) {
+    fprintf(stderr, "self-test: cannot listen on 127.0.0.1: %s\n", strerror(errno));
+    return 1;
+  }
+
+  Options opts;
+  opts.out_dir = dir_template;
+  opts.timeout_s = 5;
+  opts.hosts = {paged.host(), global.host(), truncated.host()};
+  std::string failure;
+  auto expect = [&failure](bool ok, const std::string &what) {
+    if (!ok && failure.empty())
+      failure = what;
+  };
+  auto status = [](const DeviceResult &dev, size_t page) {
+    return page < dev.pages.size() ? dev.pages[page].status : std::string("missing");
+  };
+
+  // First crawl downloads everything; a client waiting for EOF would take
+  // opts.timeout_s per request here.
+  auto start = std::chrono::steady_clock::now();
+  std::vector<DeviceResult> first = crawl_all(opts);
+  long first_ms = ms_since(start);
+  expect(first_ms < 1000, "first crawl took " + std::to_string(first_ms) + " ms (waited for EOF?)");
+  expect(first[0].pages.size() == 2 && status(first[0], 0) == "changed" && status(first[0], 1) == "changed",
+         "paged device: first crawl did not download both pages");
+  expect(load_etags(opts.out_dir + "/" + first[0].dir + "/etags.tsv").size() == 2, "paged device: ETags not saved");
+
+  // Without "pages" or page_names only the current screen exists
+  std::vector<std::string> seen = global.requests();
+  expect(first[1].pages.size() == 1 && status(first[1], 0) == "changed", "global device: current screen not fetched");
+  expect(seen.size() == 2 && seen[1] == "GET /screenshot", "global device: requested " + (seen.empty() ? "nothing" : seen.back()));
+
+  expect(status(first[2], 0) == "error" && first[2].pages[0].error.find("40 of 70 bytes") != std::string::npos,
+         "truncated body accepted: " + status(first[2], 0));
+
+  // Second crawl: conditional requests, answered 304, ETags kept
+  start = std::chrono::steady_clock::now();
+  std::vector<DeviceResult> second = crawl_all(opts);
+  long second_ms = ms_since(start);
+  seen = paged.requests();
+  expect(second_ms < 1000, "second crawl took " + std::to_string(second_ms) + " ms");
+  expect(status(second[0], 0) == "unchanged" && status(second[0], 1) == "unchanged",
+         "paged device: second crawl was not answered 304");
+  expect(seen.size() == 6 && seen[4] == "GET /screenshot?page=0 (If-None-Match)", "paged device: requested " + (seen.empty() ? "nothing" : seen.back()));
+  std::map<int, std::string> etags = load_etags(opts.out_dir + "/" + second[0].dir + "/etags.tsv");
+  expect(etags.size() == 2 && etags[1] == FakeDevice::etag(), "paged device: ETags lost after 304");
+
+  if (!failure.empty()) {
+    fprintf(stderr, "self-test FAILED: %s (output in %s)\n", failure.c_str(), dir_template);
+    return 1;
+  }
+  nftw(dir_template, [](const char *path, const struct stat *, int, FTW *) { return remove(path); }, 8, FTW_DEPTH | FTW_PHYS);
+  printf("self-test passed (200 then 304, current-screen fallback, truncated body; %ld + %ld ms)\n", first_ms,
+         second_ms);
+  return 0;
+}
+
+void usage(const char *argv0) {
+  fprintf(stderr,
+          "Usage: %s [-o DIR] [-j THREADS] [-t TIMEOUT_S] [-f FILE] [HOST[:PORT] ...]\n"
+          "       %s --self-test\n"
+          "  -o DIR        output directory (default: screenshots)\n"
+          "  -j THREADS    PNG conversion threads (default: CPU count)\n"
+          "  -t TIMEOUT_S  per-request socket timeout (default: 15)\n"
+          "  -f FILE       read hosts from FILE, one per line (# comments allowed)\n",
+          argv0, argv0);
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  if (argc == 2 && strcmp(argv[1], "--self-test") == 0)
+    return self_test();
+
+  Options opts;
+  int opt;
+  while ((opt = getopt(argc, argv, "o:j:t:f:h")) != -1) {
+    switch (opt) {
+      case 'o': opts.out_dir = optarg; break;
+      case 'j': opts.threads = std::max(1, atoi(optarg)); break;
+      case 't': opts.timeout_s = std::max(1, atoi(optarg)); break;
+      case 'f': {
+        std::ifstream in(optarg);
+        if (!in) {
+          fprintf(stderr, "Cannot read %s\n", optarg);
+          return 2;
+        }
+        std::string line;
+        while (std::getline(in, line)) {
+          line = line.substr(0, line.find('#'));
+          line.erase(0, line.find_first_not_of(" \t\r"));
+          line.erase(line.find_last_not_of(" \t\r") + 1);
+          if (!line.empty())
+            opts.hosts.push_back(line);
+        }
+        break;
+      }
+      default:
+        usage(argv[0]);
+        return 2;
+    }
+  }
+  for (int i = optind; i < argc; i++)
+    opts.hosts.emplace_back(argv[i]);
+  if (opts.hosts.empty()) {
+    usage(argv[0]);
+    return 2;
+  }
+  auto start = std::chrono::steady_clock::now();
+  std::vector<DeviceResult> devices = crawl_all(opts);
+  long elapsed_ms = ms_since(start);
+
+  int changed = 0, unchanged = 0, errors = 0;
+  for (const auto &dev : devices) {
+    if (!dev.error.empty()) {
+      fprintf(stderr, "%s: %s\n", dev.host.c_str(), dev.error.c_str());
+      errors++;
+    }
+    for (const auto &page : dev.pages) {
+      if (page.status == "changed")
+        changed++;
+      else if (page.status == "unchanged")
+        unchanged++;
+      else {
+        fprintf(stderr, "%s page %d: %s\n", dev.host.c_str(), page.page, page.error.c_str());
+        errors++;
+      }
+    }
+  }
+  if (!write_manifest(opts, devices, elapsed_ms)) {
+    fprintf(stderr, "Failed to write %s/manifest.json\n", opts.out_dir.c_str());
+    return 1;
+  }
+  printf("%zu devices: %d changed, %d unchanged, %d errors in %ld ms\n", devices.size(), changed, unchanged, errors,
+         elapsed_ms);
+  return errors > 0 ? 1 : 0;
+}
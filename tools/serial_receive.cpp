@@ -0,0 +1,418 @@
+// serial_receive -- fetch a display_capture screenshot over a serial console.
+//
+// For devices on the bench whose Wi-Fi is off or saturated. Talks to a device
+// configured with `serial_console: true` (or one that sends frames from the
+// display_capture.serial_capture action):
+//
+//   - Sends "screenshot [page]" on the port, then reads the framed packets
+//     (serial_protocol.h) out of the normal console stream
+//   - Log output that arrives between packets is passed through to stderr
+//   - A frame that arrives damaged (e.g. a log line from another task cut
+//     into a packet) is requested again, up to -r times
+//   - Writes the frame as PNG
+//
+// Build (Linux / macOS, needs zlib):
+//   g++ -std=c++17 -O2 -o serial_receive tools/serial_receive.cpp -lz
+//
+// Usage:
+//   serial_receive [-b BAUD] [-p PAGE] [-o FILE] [-t TIMEOUT_S] [-r RETRIES] [-n] DEVICE
+//   serial_receive --self-test
+//
+// --self-test runs a simulated device on a pseudo-terminal and checks the
+// whole path: command, interleaved log text, a corrupted frame, the retry,
+// and the decoded pixels. The device expands "\n" to "\r\n" like the
+// ESP-IDF console.
+
+#include "image_io.h"
+#include "../serial_protocol.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/wait.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+using esphome::display_capture::Rle565Encoder;
+using esphome::display_capture::SerialFrameReceiver;
+using esphome::display_capture::SerialFrameTransmitter;
+using esphome::display_capture::SERIAL_MAX_WIRE;
+
+namespace {
+
+// ============================================================================
+// Serial port
+// ============================================================================
+
+speed_t baud_constant(int baud) {
+  switch (baud) {
+    case 9600: return B9600;
+    case 19200: return B19200;
+    case 38400: return B38400;
+    case 57600: return B57600;
+    case 115200: return B115200;
+    case 230400: return B230400;
+#ifdef B460800
+    case 460800: return B460800;
+#endif
+#ifdef B921600
+    case 921600: return B921600;
+#endif
+#ifdef B1500000
+    case 1500000: return B1500000;
+#endif
+#ifdef B2000000
+    case 2000000: return B2000000;
+#endif
+#ifdef B3000000
+    case 3000000: return B3000000;
+#endif
+    default: return 0;
+  }
+}
+
+/// Opens a serial device in raw 8N1 mode. USB-CDC ports ignore the baud rate.
+int open_port(const std::string &path, int baud, std::string &err) {
+  int fd = open(path.c_str(), O_RDWR | O_NOCTTY);
+  if (fd < 0) {
+    err = path + ": " + strerror(errno);
+    return -1;
+  }
+  termios tio{};
+  if (tcgetattr(fd, &tio) == 0) {
+    cfmakeraw(&tio);
+    tio.c_cflag |= CLOCAL | CREAD;
+    tio.c_cflag &= ~CRTSCTS;
+    speed_t speed = baud_constant(baud);
+    if (speed == 0) {
+      err = "unsupported baud rate " + std::to_string(baud);
+      close(fd);
+      return -1;
+    }
+    cfsetispeed(&tio, speed);
+    cfsetospeed(&tio, speed);
+    tcsetattr(fd, TCSANOW, &tio);
+  }
+  return fd;
+}
+
+bool write_all(int fd, const uint8_t *data, size_t len) {
+  while (len > 0) {
+    ssize_t n = write(fd, data, len);
+    if (n < 0) {
+      if (errno == EINTR || errno == EAGAIN)
+        continue;
+      return false;
+    }
+    data += n;
+    len -= n;
+  }
+  return true;
+}
+
+long ms_since(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+// ============================================================================
+// Receiving
+// ============================================================================
+
+struct Options {
+  std::string device;
+  int baud{115200};
+  int page{-1};
+  std::string out_file{"screenshot.png"};
+  int timeout_s{30};
+  int retries{2};
+  bool send_command{true};
+  bool quiet_text{false};  ///< Don't echo console text (self-test)
+};
+
+bool send_command(int fd, int page) {
+  std::string cmd = page >= 0 ? "screenshot " + std::to_string(page) + "\n" : "screenshot\n";
+  return write_all(fd, (const uint8_t *) cmd.data(), cmd.size());
+}
+
+/// Reads from the port until a good frame arrives. Returns false on timeout,
+/// read error, or when the retries run out.
+bool receive_frame(int fd, const Options &opts, SerialFrameReceiver::Frame &frame, std::string &err) {
+  SerialFrameReceiver rx;
+  if (!opts.quiet_text) {
+    rx.on_text = [](const uint8_t *data, size_t len) { fwrite(data, 1, len, stderr); };
+  }
+
+  if (opts.send_command && !send_command(fd, opts.page)) {
+    err = std::string("write: ") + strerror(errno);
+    return false;
+  }
+  auto start = std::chrono::steady_clock::now();
+  uint32_t bad_frames = 0;
+  int attempts = 0;
+  uint8_t buf[4096];
+  while (ms_since(start) < opts.timeout_s * 1000L) {
+    pollfd pfd{fd, POLLIN, 0};
+    int rc = poll(&pfd, 1, 100);
+    if (rc < 0 && errno != EINTR) {
+      err = std::string("poll: ") + strerror(errno);
+      return false;
+    }
+    if (rc <= 0) {
+      rx.flush_text();  // port went quiet -- show pending log text
+      continue;
+    }
+    ssize_t n = read(fd, buf, sizeof(buf));
+    if (n < 0) {
+      if (errno == EINTR || errno == EAGAIN)
+        continue;
+      err = std::string("read: ") + strerror(errno);
+      return false;
+    }
+    if (n == 0) {
+      err = "port closed";
+      return false;
+    }
+    rx.feed(buf, n);
+    if (rx.take_frame(frame))
+      return true;
+
+    if (rx.bad_frames != bad_frames) {
+      bad_frames = rx.bad_frames;
+      if (!opts.send_command || ++attempts > opts.retries) {
+        err = "frame damaged in transit (" + std::to_string(rx.bad_packets) + " bad packets)";
+        return false;
+      }
+      fprintf(stderr, "serial_receive: frame damaged, requesting again\n");
+      send_command(fd, opts.page);
+    }
+  }
+  err = "timed out after " + std::to_string(opts.timeout_s) + " s";
+  return false;
+}
+
+/// RGB565 to RGB888 with the same expansion the device uses for its BMPs.
+image_io::Image to_image(const SerialFrameReceiver::Frame &frame) {
+  image_io::Image img;
+  img.width = frame.width;
+  img.height = frame.height;
+  img.rgb.resize(frame.pixels.size() * 3);
+  for (size_t i = 0; i < frame.pixels.size(); i++) {
+    uint16_t p = frame.pixels[i];
+    img.rgb[i * 3 + 0] = ((p >> 11) * 255) / 31;
+    img.rgb[i * 3 + 1] = (((p >> 5) & 0x3F) * 255) / 63;
+    img.rgb[i * 3 + 2] = ((p & 0x1F) * 255) / 31;
+  }
+  return img;
+}
+
+// ============================================================================
+// Self-test -- a simulated device on a pseudo-terminal
+// ============================================================================
+
+const int TEST_WIDTH = 200;
+const int TEST_HEIGHT = 120;
+
+uint16_t test_pixel(int x, int y) {
+  // Flat bars (long runs) over a noisy band (literals) and a band of 0x0A0A,
+  // which puts newline bytes into the packets
+  if (y >= 40 && y < 50)
+    return (uint16_t) (x * 7919 + y * 104729);
+  if (y >= 50 && y < 52)
+    return 0x0A0A;
+  return (uint16_t) ((x / 25) * 0x2104 + (y / 30) * 0x0841);
+}
+
+/// Writes like the ESP-IDF console with its default CRLF line endings: every
+/// "\n" goes out as "\r\n".
+void console_write(int fd, const uint8_t *data, size_t len) {
+  std::vector<uint8_t> out;
+  for (size_t i = 0; i < len; i++) {
+    if (data[i] == '\n')
+      out.push_back('\r');
+    out.push_back(data[i]);
+  }
+  write_all(fd, out.data(), out.size());
+}
+
+/// Device side: answers each "screenshot" line with log text and a frame.
+/// The first frame gets a log line injected mid-packet, as if another task
+/// had logged while the main loop was writing.
+void run_fake_device(int fd) {
+  std::vector<uint8_t> payload(Rle565Encoder::max_encoded_size(TEST_WIDTH * TEST_HEIGHT));
+  Rle565Encoder encoder(payload.data());
+  for (int y = 0; y < TEST_HEIGHT; y++) {
+    for (int x = 0; x < TEST_WIDTH; x++)
+      encoder.push(test_pixel(x, y));
+  }
+  encoder.finish();
+
+  const char *log_line = "[I][display_capture:123]: Sending frame over serial\n";
+  std::string line;
+  int frames = 0;
+  char c;
+  while (read(fd, &c, 1) == 1) {
+    if (c != '\n') {
+      line += c;
+      continue;
+    }
+    if (line.compare(0, 10, "screenshot") != 0) {
+      line.clear();
+      continue;
+    }
+    line.clear();
+    console_write(fd, (const uint8_t *) log_line, strlen(log_line));
+
+    SerialFrameTransmitter tx;
+    tx.begin(++frames, TEST_WIDTH, TEST_HEIGHT, payload.data(), encoder.size());
+    uint8_t wire[SERIAL_MAX_WIRE];
+    int packet = 0;
+    size_t n;
+    while ((n = tx.next_packet(wire)) > 0) {
+      if (frames == 1 && packet == 3) {
+        // Cut a log line into the middle of this packet
+        console_write(fd, wire, n / 2);
+        console_write(fd, (const uint8_t *) log_line, strlen(log_line));
+        console_write(fd, wire + n / 2, n - n / 2);
+      } else {
+        console_write(fd, wire, n);
+      }
+      if (++packet % 8 == 0)
+        console_write(fd, (const uint8_t *) log_line, strlen(log_line));
+    }
+  }
+  _exit(0);
+}
+
+int self_test() {
+  int master = posix_openpt(O_RDWR | O_NOCTTY);
+  if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0) {
+    fprintf(stderr, "self-test: cannot create a pseudo-terminal: %s\n", strerror(errno));
+    return 1;
+  }
+  termios tio{};
+  tcgetattr(master, &tio);
+  cfmakeraw(&tio);
+  tcsetattr(master, TCSANOW, &tio);
+
+  Options opts;
+  opts.device = ptsname(master);
+  opts.timeout_s = 10;
+  opts.quiet_text = true;
+  std::string err;
+  int fd = open_port(opts.device, 921600, err);
+  if (fd < 0) {
+    fprintf(stderr, "self-test: %s\n", err.c_str());
+    return 1;
+  }
+
+  pid_t pid = fork();
+  if (pid == 0) {
+    close(fd);
+    run_fake_device(master);
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  SerialFrameReceiver::Frame frame;
+  bool ok = receive_frame(fd, opts, frame, err);
+  long elapsed = ms_since(start);
+  close(fd);
+  close(master);
+  kill(pid, SIGTERM);
+  waitpid(pid, nullptr, 0);
+
+  if (!ok) {
+    fprintf(stderr, "self-test FAILED: %s\n", err.c_str());
+    return 1;
+  }
+  if (frame.width != TEST_WIDTH || frame.height != TEST_HEIGHT) {
+    fprintf(stderr, "self-test FAILED: got %dx%d\n", frame.width, frame.height);
+    return 1;
+  }
+  for (int y = 0; y < TEST_HEIGHT; y++) {
+    for (int x = 0; x < TEST_WIDTH; x++) {
+      if (frame.pixels[y * TEST_WIDTH + x] != test_pixel(x, y)) {
+        fprintf(stderr, "self-test FAILED: pixel (%d, %d) differs\n", x, y);
+        return 1;
+      }
+    }
+  }
+  image_io::Image img = to_image(frame);
+  std::vector<uint8_t> png;
+  if (!image_io::encode_png(img, png, err)) {
+    fprintf(stderr, "self-test FAILED: %s\n", err.c_str());
+    return 1;
+  }
+  printf("self-test passed (%dx%d frame, CRLF console, one retry, %ld ms)\n", frame.width, frame.height, elapsed);
+  return 0;
+}
+
+void usage(const char *argv0) {
+  fprintf(stderr,
+          "Usage: %s [-b BAUD] [-p PAGE] [-o FILE] [-t TIMEOUT_S] [-r RETRIES] [-n] DEVICE\n"
+          "       %s --self-test\n"
+          "  -b BAUD       baud rate (default: 115200; ignored by USB-CDC ports)\n"
+          "  -p PAGE       page to capture (default: the current screen)\n"
+          "  -o FILE       output PNG (default: screenshot.png)\n"
+          "  -t TIMEOUT_S  give up after this long (default: 30)\n"
+          "  -r RETRIES    re-request damaged frames this often (default: 2)\n"
+          "  -n            don't send a command; wait for a frame sent by an automation\n",
+          argv0, argv0);
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  if (argc == 2 && strcmp(argv[1], "--self-test") == 0)
+    return self_test();
+
+  Options opts;
+  int opt;
+  while ((opt = getopt(argc, argv, "b:p:o:t:r:nh")) != -1) {
+    switch (opt) {
+      case 'b': opts.baud = atoi(optarg); break;
+      case 'p': opts.page = atoi(optarg); break;
+      case 'o': opts.out_file = optarg; break;
+      case 't': opts.timeout_s = std::max(1, atoi(optarg)); break;
+      case 'r': opts.retries = std::max(0, atoi(optarg)); break;
+      case 'n': opts.send_command = false; break;
+      default:
+        usage(argv[0]);
+        return 2;
+    }
+  }
+  if (optind != argc - 1) {
+    usage(argv[0]);
+    return 2;
+  }
+  opts.device = argv[optind];
+
+  std::string err;
+  int fd = open_port(opts.device, opts.baud, err);
+  if (fd < 0) {
+    fprintf(stderr, "%s\n", err.c_str());
+    return 1;
+  }
+  auto start = std::chrono::steady_clock::now();
+  SerialFrameReceiver::Frame frame;
+  bool ok = receive_frame(fd, opts, frame, err);
+  close(fd);
+  if (!ok) {
+    fprintf(stderr, "serial_receive: %s\n", err.c_str());
+    return 1;
+  }
+
+  std::vector<uint8_t> png;
+  if (!image_io::encode_png(to_image(frame), png, err) || !image_io::write_file(opts.out_file, png)) {
+    fprintf(stderr, "serial_receive: cannot write %s %s\n", opts.out_file.c_str(), err.c_str());
+    return 1;
+  }
+  printf("%dx%d frame -> %s in %ld ms\n", frame.width, frame.height, opts.out_file.c_str(), ms_since(start));
+  return 0;
+}
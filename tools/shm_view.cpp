@@ -0,0 +1,377 @@
+// shm_view -- read live frames from a host build's shared-memory framebuffer.
+//
+// For UI development on a Linux host build configured with `shared_memory:`.
+// The component publishes every change of the framebuffer into a POSIX
+// shared-memory segment (shm_protocol.h); this tool reads it without going
+// through HTTP:
+//
+//   - Writes the current frame as PNG, rotated as it is on screen
+//   - With -w, follows the display for a while: every new frame is reported
+//     (or written, if the output name contains %u), with its latency
+//
+// Build (Linux, needs zlib):
+//   g++ -std=c++17 -O2 -o shm_view tools/shm_view.cpp -lz
+//
+// Usage:
+//   shm_view [-n NAME] [-o FILE] [-t TIMEOUT_S] [-w SECONDS]
+//   shm_view --self-test
+//
+// --self-test first checks, in process, that the component's publish path
+// (ShmFrameWriter::publish_if_changed()) skips unchanged frames and publishes
+// changed pixels and layouts. Then a writer in a second process publishes
+// thousands of frames per second through it (switching geometry every few
+// hundred) while this process reads for a second, checking that no frame is
+// ever seen torn.
+
+#include "image_io.h"
+#include "../shm_protocol.h"
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+using esphome::display_capture::shm_monotonic_us;
+using esphome::display_capture::shm_screen_pixel;
+using esphome::display_capture::shm_screen_size;
+using esphome::display_capture::SHM_BIG_ENDIAN;
+using esphome::display_capture::SHM_LITTLE_ENDIAN;
+using esphome::display_capture::ShmFrameLayout;
+using esphome::display_capture::ShmFrameReader;
+using esphome::display_capture::ShmFrameWriter;
+
+namespace {
+
+// ============================================================================
+// Reading
+// ============================================================================
+
+struct Options {
+  std::string name{"/display_capture"};
+  std::string out_file{"screenshot.png"};
+  int timeout_s{10};
+  int watch_s{0};  ///< 0 = write one frame and exit
+};
+
+long ms_since(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+/// Opens the segment and reads the first frame, waiting up to the timeout
+/// for the device to start and publish.
+bool wait_for_frame(ShmFrameReader &reader, const Options &opts, ShmFrameReader::Frame &frame, std::string &err) {
+  auto start = std::chrono::steady_clock::now();
+  bool opened = false;
+  while (ms_since(start) < opts.timeout_s * 1000L) {
+    if (!opened)
+      opened = reader.open(opts.name.c_str());
+    if (opened && reader.read(frame))
+      return true;
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  }
+  err = opened ? "no frame published in " + opts.name : "no shared-memory segment " + opts.name;
+  return false;
+}
+
+/// RGB565 to RGB888 in screen orientation, with the expansion the device uses for its BMPs.
+image_io::Image to_image(const ShmFrameReader::Frame &frame) {
+  image_io::Image img;
+  shm_screen_size(frame.layout, img.width, img.height);
+  img.rgb.resize((size_t) img.width * img.height * 3);
+  uint8_t *out = img.rgb.data();
+  for (int y = 0; y < img.height; y++) {
+    for (int x = 0; x < img.width; x++, out += 3) {
+      uint16_t p = shm_screen_pixel(frame.layout, frame.pixels.data(), x, y);
+      out[0] = ((p >> 11) * 255) / 31;
+      out[1] = (((p >> 5) & 0x3F) * 255) / 63;
+      out[2] = ((p & 0x1F) * 255) / 31;
+    }
+  }
+  return img;
+}
+
+bool write_png(const ShmFrameReader::Frame &frame, const std::string &path, std::string &err) {
+  std::vector<uint8_t> png;
+  if (!image_io::encode_png(to_image(frame), png, err))
+    return false;
+  if (!image_io::write_file(path, png)) {
+    err = "cannot write " + path;
+    return false;
+  }
+  return true;
+}
+
+/// Follows the segment for opts.watch_s seconds. Polls the seqlock counter,
+/// which costs nothing while the display is idle.
+int watch(ShmFrameReader &reader, const Options &opts, ShmFrameReader::Frame &frame) {
+  bool numbered = opts.out_file.find('%') != std::string::npos;
+  auto start = std::chrono::steady_clock::now();
+  uint32_t seen = reader.sequence();
+  uint64_t frames = 0;
+  uint64_t first = frame.frame;
+  std::string err;
+  while (ms_since(start) < opts.watch_s * 1000L) {
+    if (reader.sequence() == seen) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      continue;
+    }
+    if (!reader.read(frame))
+      continue;
+    seen = reader.sequence();
+    frames++;
+    uint64_t latency_us = shm_monotonic_us() - frame.timestamp_us;
+    if (numbered) {
+      char path[512];
+      snprintf(path, sizeof(path), opts.out_file.c_str(), (unsigned) frame.frame);
+      if (!write_png(frame, path, err)) {
+        fprintf(stderr, "shm_view: %s\n", err.c_str());
+        return 1;
+      }
+      printf("frame %llu -> %s (%llu us after publish)\n", (unsigned long long) frame.frame, path,
+             (unsigned long long) latency_us);
+    } else {
+      printf("frame %llu, %llu us after publish\n", (unsigned long long) frame.frame, (unsigned long long) latency_us);
+    }
+  }
+  printf("%llu frames in %d s (%llu published, %.1f fps)\n", (unsigned long long) frames, opts.watch_s,
+         (unsigned long long) (frame.frame - first), frames / (double) opts.watch_s);
+  return 0;
+}
+
+// ============================================================================
+// Self-test -- a writer process publishing at a high frame rate
+// ============================================================================
+
+/// Frames between geometry changes in the test writer.
+const uint64_t TEST_PHASE = 500;
+
+/// Odd phases are a larger, rotated frame, so the segment has to grow.
+ShmFrameLayout test_layout(uint64_t frame) {
+  bool large = (frame / TEST_PHASE) % 2 == 1;
+  ShmFrameLayout layout;
+  layout.width = large ? 320 : 160;
+  layout.height = large ? 240 : 120;
+  layout.stride = layout.width * 2;
+  layout.byte_order = SHM_LITTLE_ENDIAN;
+  layout.rotation = large ? 90 : 0;
+  return layout;
+}
+
+/// Fills a frame of `layout` with the 16-bit value `n`.
+void fill_test_frame(const ShmFrameLayout &layout, uint64_t n, std::vector<uint8_t> &px) {
+  px.resize(layout.pixel_bytes());
+  for (size_t i = 0; i < px.size(); i += 2) {
+    px[i] = n & 0xFF;
+    px[i + 1] = (n >> 8) & 0xFF;
+  }
+}
+
+/// Publishes a few thousand frames per second until killed, the way the
+/// component does. Every pixel of frame n holds n (low 16 bits), so a frame
+/// mixed from two writes shows up as differing pixels.
+void run_writer(const char *name) {
+  ShmFrameWriter writer;
+  if (!writer.open(name))
+    _exit(1);
+  std::vector<uint8_t> px;
+  for (uint64_t n = 1;; n++) {
+    ShmFrameLayout layout = test_layout(n);
+    fill_test_frame(layout, n, px);
+    writer.publish_if_changed(layout, px.data(), layout.stride);
+    // A device publishes at most once per loop() pass; back-to-back writes
+    // would starve the reader's retries (seqlocks favour the writer).
+    std::this_thread::sleep_for(std::chrono::microseconds(100));
+  }
+}
+
+int self_test() {
+  std::string name = "/shm_view_self_test_" + std::to_string(getpid());
+  // Rotation check first: a 3x2 native frame shown at 90 degrees is 2x3.
+  {
+    ShmFrameLayout layout;
+    layout.width = 3;
+    layout.height = 2;
+    layout.stride = 6;
+    layout.byte_order = SHM_BIG_ENDIAN;
+    layout.rotation = 90;
+    const uint8_t native[12] = {0, 1, 0, 2, 0, 3, 0, 4, 0, 5, 0, 6};  // rows: 1 2 3 / 4 5 6
+    // draw_pixel_at() at 90 degrees stores screen (x, y) at native (w-1-y, x).
+    const uint16_t screen[3][2] = {{3, 6}, {2, 5}, {1, 4}};
+    int w, h;
+    shm_screen_size(layout, w, h);
+    if (w != 2 || h != 3) {
+      fprintf(stderr, "self-test FAILED: rotated size %dx%d\n", w, h);
+      return 1;
+    }
+    for (int y = 0; y < 3; y++) {
+      for (int x = 0; x < 2; x++) {
+        if (shm_screen_pixel(layout, native, x, y) != screen[y][x]) {
+          fprintf(stderr, "self-test FAILED: rotated pixel (%d, %d)\n", x, y);
+          return 1;
+        }
+      }
+    }
+  }
+
+  // Change detection: the component calls publish_if_changed() on every loop() pass.
+  {
+    ShmFrameWriter writer;
+    ShmFrameReader reader;
+    ShmFrameReader::Frame frame;
+    std::vector<uint8_t> px;
+    ShmFrameLayout layout = test_layout(1);
+    fill_test_frame(layout, 7, px);
+    const char *fail = nullptr;
+    if (!writer.open(name.c_str()) || !reader.open(name.c_str()))
+      fail = "cannot open the segment";
+    else if (!writer.publish_if_changed(layout, px.data(), layout.stride) || !reader.read(frame) || frame.frame != 1)
+      fail = "first frame not published";
+    else if (writer.publish_if_changed(layout, px.data(), layout.stride))
+      fail = "unchanged frame published again";
+    if (fail == nullptr) {
+      px[px.size() - 1] ^= 1;  // last byte of the last row
+      if (!writer.publish_if_changed(layout, px.data(), layout.stride) || !reader.read(frame) || frame.frame != 2 ||
+          frame.pixels != px)
+        fail = "changed pixel not published";
+    }
+    if (fail == nullptr) {
+      layout.rotation = 180;  // same pixels, new layout
+      if (!writer.publish_if_changed(layout, px.data(), layout.stride) || !reader.read(frame) ||
+          frame.layout != layout)
+        fail = "changed layout not published";
+    }
+    if (fail == nullptr) {
+      // Rows spaced wider than the frame's stride, as from a padded framebuffer.
+      std::vector<uint8_t> padded(px.size() + layout.height * 8, 0xAA);
+      for (uint32_t y = 0; y < layout.height; y++)
+        memcpy(&padded[y * (layout.stride + 8)], &px[y * layout.stride], layout.stride);
+      if (writer.publish_if_changed(layout, padded.data(), layout.stride + 8))
+        fail = "padded copy of the same frame published again";
+    }
+    shm_unlink(name.c_str());
+    if (fail != nullptr) {
+      fprintf(stderr, "self-test FAILED: %s\n", fail);
+      return 1;
+    }
+  }
+
+  pid_t pid = fork();
+  if (pid == 0)
+    run_writer(name.c_str());
+
+  Options opts;
+  opts.name = name;
+  opts.timeout_s = 5;
+  ShmFrameReader reader;
+  ShmFrameReader::Frame frame;
+  std::string err;
+  bool ok = wait_for_frame(reader, opts, frame, err);
+  uint64_t first = frame.frame;
+  uint64_t last = 0;
+  int reads = 0;
+  bool seen_small = false, seen_large = false;
+  auto start = std::chrono::steady_clock::now();
+  while (ok && ms_since(start) < 1000) {
+    if (!reader.read(frame))
+      continue;
+    reads++;
+    if (frame.layout != test_layout(frame.frame) || frame.pixels.size() != frame.layout.pixel_bytes()) {
+      err = "frame " + std::to_string(frame.frame) + " has the wrong layout";
+      ok = false;
+      break;
+    }
+    (frame.layout.rotation == 90 ? seen_large : seen_small) = true;
+    uint16_t expect = frame.frame & 0xFFFF;
+    for (size_t i = 0; i < frame.pixels.size(); i += 2) {
+      if ((uint16_t) (frame.pixels[i] | frame.pixels[i + 1] << 8) != expect) {
+        err = "frame " + std::to_string(frame.frame) + " is torn at byte " + std::to_string(i);
+        ok = false;
+        break;
+      }
+    }
+    if (frame.frame < last) {
+      err = "frame number went back";
+      ok = false;
+    }
+    last = frame.frame;
+  }
+  long elapsed = ms_since(start);
+  kill(pid, SIGTERM);
+  int status = 0;
+  waitpid(pid, &status, 0);
+  shm_unlink(name.c_str());
+
+  if (ok && (reads < 100 || !seen_small || !seen_large)) {
+    err = "only " + std::to_string(reads) + " reads, writer may have stalled";
+    ok = false;
+  }
+  if (!ok) {
+    fprintf(stderr, "self-test FAILED: %s\n", err.c_str());
+    return 1;
+  }
+  printf("self-test passed (%d intact reads of %llu published frames, both geometries, %ld ms)\n", reads,
+         (unsigned long long) (last - first), elapsed);
+  return 0;
+}
+
+void usage(const char *argv0) {
+  fprintf(stderr,
+          "Usage: %s [-n NAME] [-o FILE] [-t TIMEOUT_S] [-w SECONDS]\n"
+          "       %s --self-test\n"
+          "  -n  shared-memory segment, as in the `shared_memory:` option (default /display_capture)\n"
+          "  -o  output PNG (default screenshot.png); with -w, a name containing %%u writes every frame\n"
+          "  -t  seconds to wait for the device to publish a frame (default 10)\n"
+          "  -w  follow the display for this many seconds, reporting each new frame\n",
+          argv0, argv0);
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  if (argc == 2 && strcmp(argv[1], "--self-test") == 0)
+    return self_test();
+
+  Options opts;
+  int opt;
+  while ((opt = getopt(argc, argv, "n:o:t:w:h")) != -1) {
+    switch (opt) {
+      case 'n': opts.name = optarg[0] == '/' ? optarg : std::string("/") + optarg; break;
+      case 'o': opts.out_file = optarg; break;
+      case 't': opts.timeout_s = std::max(1, atoi(optarg)); break;
+      case 'w': opts.watch_s = std::max(1, atoi(optarg)); break;
+      default:
+        usage(argv[0]);
+        return 2;
+    }
+  }
+  if (optind != argc) {
+    usage(argv[0]);
+    return 2;
+  }
+
+  ShmFrameReader reader;
+  ShmFrameReader::Frame frame;
+  std::string err;
+  if (!wait_for_frame(reader, opts, frame, err)) {
+    fprintf(stderr, "shm_view: %s\n", err.c_str());
+    return 1;
+  }
+  if (opts.watch_s > 0)
+    return watch(reader, opts, frame);
+
+  if (!write_png(frame, opts.out_file, err)) {
+    fprintf(stderr, "shm_view: %s\n", err.c_str());
+    return 1;
+  }
+  int w, h;
+  shm_screen_size(frame.layout, w, h);
+  printf("%dx%d frame %llu -> %s\n", w, h, (unsigned long long) frame.frame, opts.out_file.c_str());
+  return 0;
+}